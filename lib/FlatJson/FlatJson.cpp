@@ -0,0 +1,201 @@
+#include "FlatJson.h"
+
+FlatJsonParser::FlatJsonParser(FieldCallback callback, void* context) : callback(callback), context(context) {
+  reset();
+}
+
+void FlatJsonParser::reset() {
+  state = EXPECT_OBJECT;
+  err = flatjson_ok;
+  keyLength = 0;
+  valueLength = 0;
+  escape = 0;
+}
+
+bool FlatJsonParser::feed(const char* data, size_t length) {
+  for (size_t i = 0; i < length; i++){
+    if(!feed(data[i])) return false;
+  }
+  return true;
+}
+
+/*!
+    returns false once the input can not be a valid object anymore, error() tells why
+*/
+
+bool FlatJsonParser::feed(char c) {
+  bool whitespace = (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+  switch(state){
+    case EXPECT_OBJECT:
+      if(whitespace) return true;
+      if(c != '{') return fail(flatjson_syntax);
+      state = EXPECT_FIRST_KEY;
+      return true;
+
+    case EXPECT_FIRST_KEY:
+    case EXPECT_KEY:
+      if(whitespace) return true;
+      if(c == '}' && state == EXPECT_FIRST_KEY){ // empty object, after a comma a key has to follow
+        state = DONE;
+        return true;
+      }
+      if(c != '"') return fail(flatjson_syntax);
+      keyLength = 0;
+      state = IN_KEY;
+      return true;
+
+    case IN_KEY:
+      if(escape){
+        return appendEscape(c);
+      }
+      if(c == '\\'){
+        escape = 1;
+        escapeInKey = true;
+        return true;
+      }
+      if(c == '"'){
+        key[keyLength] = '\0';
+        state = EXPECT_COLON;
+        return true;
+      }
+      if((uint8_t)c < 0x20) return fail(flatjson_syntax);
+      return append(key, keyLength, FLATJSON_MAX_KEY_LENGTH, c);
+
+    case EXPECT_COLON:
+      if(whitespace) return true;
+      if(c != ':') return fail(flatjson_syntax);
+      valueLength = 0;
+      state = EXPECT_VALUE;
+      return true;
+
+    case EXPECT_VALUE:
+      if(whitespace) return true;
+      if(c == '"'){
+        state = IN_STRING;
+        return true;
+      }
+      if(c == '{' || c == '[' || c == ',' || c == '}' || c == ':') return fail(flatjson_syntax);
+      state = IN_LITERAL;
+      return append(value, valueLength, FLATJSON_MAX_VALUE_LENGTH, c);
+
+    case IN_STRING:
+      if(escape){
+        return appendEscape(c);
+      }
+      if(c == '\\'){
+        escape = 1;
+        escapeInKey = false;
+        return true;
+      }
+      if(c == '"'){
+        emit(true);
+        state = EXPECT_NEXT;
+        return true;
+      }
+      if((uint8_t)c < 0x20) return fail(flatjson_syntax);
+      return append(value, valueLength, FLATJSON_MAX_VALUE_LENGTH, c);
+
+    case IN_LITERAL:
+      if(whitespace || c == ',' || c == '}'){
+        emit(false);
+        state = EXPECT_NEXT;
+        return whitespace ? true : feed(c);
+      }
+      if(c == '"' || c == '{' || c == '[' || c == ':') return fail(flatjson_syntax);
+      return append(value, valueLength, FLATJSON_MAX_VALUE_LENGTH, c);
+
+    case EXPECT_NEXT:
+      if(whitespace) return true;
+      if(c == ','){
+        state = EXPECT_KEY;
+        return true;
+      }
+      if(c == '}'){
+        state = DONE;
+        return true;
+      }
+      return fail(flatjson_syntax);
+
+    case DONE:
+      if(whitespace) return true;
+      return fail(flatjson_syntax);
+
+    case FAILED:
+      return false;
+  }
+  return false;
+}
+
+/*!
+    true if exactly one complete object was fed
+*/
+
+bool FlatJsonParser::finish() {
+  if(state == DONE) return true;
+  if(state != FAILED) fail(flatjson_incomplete);
+  return false;
+}
+
+bool FlatJsonParser::fail(uint8_t error) {
+  state = FAILED;
+  err = error;
+  return false;
+}
+
+bool FlatJsonParser::append(char* buffer, uint8_t& length, uint8_t capacity, char c) {
+  if(length >= capacity) return fail(buffer == key ? flatjson_key_too_long : flatjson_too_long);
+  buffer[length++] = c;
+  return true;
+}
+
+// handles the character after a backslash, \u escapes are written as utf-8 (no surrogate pairs)
+bool FlatJsonParser::appendEscape(char c) {
+  char* buffer = escapeInKey ? key : value;
+  uint8_t& length = escapeInKey ? keyLength : valueLength;
+  uint8_t capacity = escapeInKey ? FLATJSON_MAX_KEY_LENGTH : FLATJSON_MAX_VALUE_LENGTH;
+
+  if(escape == 1){
+    escape = 0;
+    switch(c){
+      case '"': case '\\': case '/': return append(buffer, length, capacity, c);
+      case 'b': return append(buffer, length, capacity, '\b');
+      case 'f': return append(buffer, length, capacity, '\f');
+      case 'n': return append(buffer, length, capacity, '\n');
+      case 'r': return append(buffer, length, capacity, '\r');
+      case 't': return append(buffer, length, capacity, '\t');
+      case 'u':
+        escape = 2;
+        codepoint = 0;
+        return true;
+      default: return fail(flatjson_syntax);
+    }
+  }
+
+  uint8_t digit;
+  if(c >= '0' && c <= '9') digit = c - '0';
+  else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+  else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+  else return fail(flatjson_syntax);
+  codepoint = (codepoint << 4) | digit;
+  if(++escape <= 5) return true;
+
+  escape = 0;
+  if(codepoint == 0 || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) return fail(flatjson_syntax);
+  if(codepoint < 0x80){
+    return append(buffer, length, capacity, codepoint);
+  }
+  if(codepoint < 0x800){
+    return append(buffer, length, capacity, 0xC0 | (codepoint >> 6)) &&
+           append(buffer, length, capacity, 0x80 | (codepoint & 0x3F));
+  }
+  return append(buffer, length, capacity, 0xE0 | (codepoint >> 12)) &&
+         append(buffer, length, capacity, 0x80 | ((codepoint >> 6) & 0x3F)) &&
+         append(buffer, length, capacity, 0x80 | (codepoint & 0x3F));
+}
+
+void FlatJsonParser::emit(bool quoted) {
+  value[valueLength] = '\0';
+  callback(key, value, quoted, context);
+  valueLength = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef FLATJSON_H
+#define FLATJSON_H
+
+#include <Arduino.h>
+
+#define FLATJSON_MAX_KEY_LENGTH 24
+#define FLATJSON_MAX_VALUE_LENGTH 33
+
+/*!
+    Streaming parser for a flat JSON object ({"key": value, ...} without nested objects or arrays).
+    Characters are fed one at a time into fixed buffers, every complete key/value pair is handed to the callback.
+    String values are unescaped, other values (numbers, true, false, null) are passed as written.
+*/
+
+enum flatjson_error {flatjson_ok = 0, flatjson_syntax = 1, flatjson_too_long = 2, flatjson_incomplete = 3, flatjson_key_too_long = 4};
+
+class FlatJsonParser {
+public:
+    typedef void (*FieldCallback)(const char* key, const char* value, bool quoted, void* context);
+
+    FlatJsonParser(FieldCallback callback, void* context);
+    void reset();
+    bool feed(char c);
+    bool feed(const char* data, size_t length);
+    bool finish();
+    uint8_t error() const { return err; }
+
+private:
+    enum State {EXPECT_OBJECT, EXPECT_FIRST_KEY, EXPECT_KEY, IN_KEY, EXPECT_COLON, EXPECT_VALUE, IN_STRING, IN_LITERAL, EXPECT_NEXT, DONE, FAILED};
+
+    bool fail(uint8_t error);
+    bool append(char* buffer, uint8_t& length, uint8_t capacity, char c);
+    bool appendEscape(char c);
+    void emit(bool quoted);
+
+    FieldCallback callback;
+    void* context;
+    State state;
+    uint8_t err;
+    char key[FLATJSON_MAX_KEY_LENGTH + 1];
+    uint8_t keyLength;
+    char value[FLATJSON_MAX_VALUE_LENGTH + 1];
+    uint8_t valueLength;
+    uint8_t escape; // 0: none, 1: after backslash, 2-5: digits of a \u escape
+    uint16_t codepoint;
+    bool escapeInKey;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "HeapProbe.h"
+
+#ifdef HEAP_PROBE
+
+#include <malloc.h>
+
+static volatile uint8_t current_path = HEAP_PATH_IDLE;
+static HeapPathStats path_stats[HEAP_PATH_COUNT];
+
+static void record() {
+    HeapPathStats& stats = path_stats[current_path];
+    stats.allocations++;
+#ifdef ARDUINO
+    uint32_t used = mallinfo().uordblks;
+#else
+    uint32_t used = mallinfo2().uordblks;
+#endif
+    if(used > stats.highWater){
+        stats.highWater = used;
+    }
+}
+
+#ifdef ARDUINO
+
+// The core already wraps malloc() for its heap lock, so the counting is hooked in one level
+// below on the newlib reentrant functions, linked with -Wl,--wrap=_malloc_r,--wrap=_calloc_r,--wrap=_realloc_r
+extern "C" {
+void* __real__malloc_r(struct _reent* r, size_t size);
+void* __real__calloc_r(struct _reent* r, size_t n, size_t size);
+void* __real__realloc_r(struct _reent* r, void* ptr, size_t size);
+}
+
+extern "C" void* __wrap__malloc_r(struct _reent* r, size_t size) {
+    void* p = __real__malloc_r(r, size);
+    record();
+    return p;
+}
+
+extern "C" void* __wrap__calloc_r(struct _reent* r, size_t n, size_t size) {
+    void* p = __real__calloc_r(r, n, size);
+    record();
+    return p;
+}
+
+extern "C" void* __wrap__realloc_r(struct _reent* r, void* ptr, size_t size) {
+    void* p = __real__realloc_r(r, ptr, size);
+    record();
+    return p;
+}
+
+#else
+
+// Host build (env:native): glibc lets the program replace malloc, the replacements hand over to the
+// glibc allocator. operator new of libstdc++ ends up here as well, free() stays the one of glibc.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    void* p = __libc_malloc(size);
+    record();
+    return p;
+}
+
+void* calloc(size_t n, size_t size) {
+    void* p = __libc_calloc(n, size);
+    record();
+    return p;
+}
+
+void* realloc(void* ptr, size_t size) {
+    void* p = __libc_realloc(ptr, size);
+    record();
+    return p;
+}
+}
+
+#endif
+
+uint8_t HeapProbe::enter(uint8_t path) {
+    uint8_t previous = current_path;
+    current_path = path;
+    return previous;
+}
+
+void HeapProbe::leave(uint8_t previousPath) {
+    current_path = previousPath;
+}
+
+HeapPathStats HeapProbe::get(uint8_t path) {
+    noInterrupts();
+    HeapPathStats stats = path_stats[path];
+    interrupts();
+    return stats;
+}
+
+void HeapProbe::reset() {
+    noInterrupts();
+    memset(path_stats, 0, sizeof(path_stats));
+    interrupts();
+}
+
+void HeapProbe::print(Print& out) {
+    static const char* names[HEAP_PATH_COUNT] = {"idle", "i2c", "portal", "ntp"};
+    char line[64];
+    for (uint8_t i = 0; i < HEAP_PATH_COUNT; i++){
+        HeapPathStats stats = get(i);
+        snprintf(line, sizeof(line), "heap %s: %lu allocations, high water %lu bytes\r\n", names[i],
+                 (unsigned long)stats.allocations, (unsigned long)stats.highWater);
+        out.print(line);
+    }
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef HEAPPROBE_H
+#define HEAPPROBE_H
+
+#include <Arduino.h>
+
+/*!
+    Attributes heap allocations to the code path that made them.
+    Only active when built with HEAP_PROBE defined (see the pico_heapprobe environment),
+    otherwise every call compiles to nothing.
+*/
+
+enum heap_path {HEAP_PATH_IDLE = 0, HEAP_PATH_I2C = 1, HEAP_PATH_PORTAL = 2, HEAP_PATH_NTP = 3, HEAP_PATH_COUNT = 4};
+
+struct HeapPathStats {
+    uint32_t allocations;
+    uint32_t highWater; // heap bytes in use, highest value seen by an allocation from this path
+};
+
+class HeapProbe {
+public:
+#ifdef HEAP_PROBE
+    static uint8_t enter(uint8_t path);
+    static void leave(uint8_t previousPath);
+    static HeapPathStats get(uint8_t path);
+    static void reset();
+    static void print(Print& out);
+#else
+    static uint8_t enter(uint8_t /*path*/) { return HEAP_PATH_IDLE; }
+    static void leave(uint8_t /*previousPath*/) {}
+    static HeapPathStats get(uint8_t /*path*/) { return HeapPathStats{0, 0}; }
+    static void reset() {}
+    static void print(Print& /*out*/) {}
+#endif
+};
+
+// marks the enclosing scope as the given path, restores the previous one when it ends so it can be used in interrupts
+class HeapProbeScope {
+public:
+    HeapProbeScope(uint8_t path) : previous(HeapProbe::enter(path)) {}
+    ~HeapProbeScope() { HeapProbe::leave(previous); }
+
+private:
+    uint8_t previous;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "I2cProtocol.h"
+
+/*!
+    returns the command id if the checksum matches and the length fits the command, cmd_invalid otherwise
+    bufferLength includes the checksum byte
+*/
+uint8_t decodeCommand(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength)
+{
+  if(bufferLength < 2 || bufferLength > MAX_COMMAND_LENGTH + 1 || !verifyChecksum(buffer, bufferLength)){
+    return cmd_invalid;
+  }
+
+  size_t dataLength = bufferLength - 1;
+  switch(buffer[0]){
+    case enable_ap: return dataLength == sizeof(cmd_enable_ap_data) ? enable_ap : cmd_invalid;
+    case poll_ntp: return dataLength == sizeof(cmd_poll_ntp_data) ? poll_ntp : cmd_invalid;
+    case reset_data: return dataLength == 1 ? reset_data : cmd_invalid;
+    case provision_chunk: return dataLength == sizeof(cmd_provision_chunk_data) ? provision_chunk : cmd_invalid;
+    case provision_commit: return dataLength == 1 ? provision_commit : cmd_invalid;
+    case provision_read: return dataLength == sizeof(cmd_provision_read_data) ? provision_read : cmd_invalid;
+    case set_distribution: return dataLength == sizeof(cmd_set_distribution_data) ? set_distribution : cmd_invalid;
+    default: return cmd_invalid;
+  }
+}
+
+// status and local time, answers a poll and is pushed to the controllers in distribution mode
+void getTimeReply(byte (&buffer)[REPLY_LENGTH], uint8_t status, const settings& s, Timezone& tz, int64_t utc)
+{
+  time_t t = 0;
+
+  if (s.useGmtOffset){
+    t = utc + s.gmtOffset * SECS_PER_HOUR;
+  } else {
+    t = tz.toLocal(utc);
+  }
+
+  buffer[0] = status;
+  buffer[1] = (byte)hour(t);
+  buffer[2] = (byte)minute(t);
+  buffer[3] = (byte)second(t);
+  buffer[4] = getChecksum(buffer);
+}
+
+void settingsToPayload(const settings& s, provision_payload& payload)
+{
+  payload.ssidLength = s.ssidLength;
+  payload.passLength = s.passLength;
+  memcpy(payload.ssid, s.ssid, 32);
+  memcpy(payload.pass, s.pass, 32);
+  payload.isProtected = s.isProtected;
+  payload.useGmtOffset = s.useGmtOffset;
+  payload.gmtOffset = s.gmtOffset;
+  payload.timezoneIdx = s.timezoneIdx;
+}
+
+void payloadToSettings(const provision_payload& payload, settings& s)
+{
+  s.ssidLength = min((int)payload.ssidLength, 33); //anything above 32 is rejected by validateSettings
+  s.passLength = min((int)payload.passLength, 33);
+  memset(s.ssid, 0, sizeof(s.ssid));
+  memset(s.pass, 0, sizeof(s.pass));
+  memcpy(s.ssid, payload.ssid, min((int)s.ssidLength, 32));
+  memcpy(s.pass, payload.pass, min((int)s.passLength, 32));
+  s.isProtected = payload.isProtected;
+  s.useGmtOffset = payload.useGmtOffset;
+  s.gmtOffset = payload.gmtOffset;
+  s.timezoneIdx = payload.timezoneIdx;
+}
+
+bool verifyChecksum(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength)
+{
+  uint8_t checksum = 0;
+  for(int i = 0; i < bufferLength - 1; i++){
+    checksum += buffer[i];
+  }
+  return checksum == buffer[bufferLength - 1];
+}
+
+// 0x00-0x07 and 0x78-0x7F are reserved (general call, cbus, hs mode, 10 bit addressing), the own address can not be a controller
+bool isValidDistributionAddress(uint8_t address, uint8_t ownAddress)
+{
+  return address >= 0x08 && address <= 0x77 && address != ownAddress;
+}
@@ -0,0 +1,86 @@
+#ifndef I2CPROTOCOL_H
+#define I2CPROTOCOL_H
+
+#include <Arduino.h>
+#include <Timezone.h>
+#include <Settings.h>
+
+/*!
+    Wire format between the master controller and this module: the commands, the time reply and the provisioning payload.
+    Everything here is called from the i2c interrupt and must not touch the heap.
+*/
+
+#define PROVISION_CHUNK_LENGTH 16 //settings bytes carried by one provisioning chunk
+#define MAX_COMMAND_LENGTH (PROVISION_CHUNK_LENGTH + 2) //max length of a command data in bytes, used for checksum buffer
+#define REPLY_LENGTH 5 //length of the reply in bytes
+#define PROVISION_REPLY_LENGTH (PROVISION_CHUNK_LENGTH + 3) //length of a provisioning readback reply in bytes
+#define MAX_DISTRIBUTION_ADDRESSES (MAX_COMMAND_LENGTH - 3) //receivers of the time push, as many as fit into one command
+#define TIME_FRAME_LENGTH (REPLY_LENGTH + 1) //frame type byte followed by the reply to a poll
+
+enum cmd_identifier {enable_ap = 0, poll_ntp = 1, reset_data = 2, provision_chunk = 3, provision_commit = 4, provision_read = 5, set_distribution = 6, cmd_invalid = 0xFF};
+
+#pragma pack(push, 1) // exact fit - no padding
+
+struct cmd_enable_ap_data {
+  uint8_t cmd_id;
+  bool enable; //1bytes # true enables the acces point for configuration, false disables it
+};
+
+struct cmd_poll_ntp_data {
+  uint8_t cmd_id;
+  uint16_t ntp_timeout; //2bytes, timeout in s
+  uint16_t ntp_time_validity; //2bytes, how long the retrieved time will be valid
+};
+
+struct cmd_provision_chunk_data {
+  uint8_t cmd_id;
+  uint8_t seq; //1byte, chunk index, seq 0 starts a new transfer, chunks have to arrive in order
+  byte data[PROVISION_CHUNK_LENGTH]; //16bytes, part of the provision_payload, the last chunk is zero padded
+};
+
+struct cmd_provision_read_data {
+  uint8_t cmd_id;
+  uint8_t seq; //1byte, chunk index of the stored settings returned by the next request
+};
+
+struct cmd_set_distribution_data {
+  uint8_t cmd_id;
+  uint8_t mode; //1byte, distribution_mode, off: the controllers poll, list: push to the addresses, broadcast: push as hardware general call
+  uint8_t num_addresses; //1byte, used entries of addresses in list mode
+  uint8_t addresses[MAX_DISTRIBUTION_ADDRESSES]; //15bytes, 7 bit addresses of the controllers, the list is rejected if one is reserved or this module
+};
+
+// wire format of the settings for provisioning, split into chunks of PROVISION_CHUNK_LENGTH bytes
+struct provision_payload {
+  uint8_t ssidLength;
+  uint8_t passLength;
+  char ssid[32]; //not null terminated
+  char pass[32]; //not null terminated
+  bool isProtected;
+  bool useGmtOffset;
+  int8_t gmtOffset;
+  uint8_t timezoneIdx;
+};
+
+#pragma pack(pop)
+
+const uint8_t PROVISION_NUM_CHUNKS = (sizeof(provision_payload) + PROVISION_CHUNK_LENGTH - 1) / PROVISION_CHUNK_LENGTH;
+const uint8_t PROVISION_SEQ_INVALID = 0xFF;
+
+uint8_t decodeCommand(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength);
+void getTimeReply(byte (&buffer)[REPLY_LENGTH], uint8_t status, const settings& s, Timezone& tz, int64_t utc);
+void settingsToPayload(const settings& s, provision_payload& payload);
+void payloadToSettings(const provision_payload& payload, settings& s);
+bool verifyChecksum(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength);
+bool isValidDistributionAddress(uint8_t address, uint8_t ownAddress);
+
+// sum of every byte but the last one, the last one is where the checksum goes
+template <size_t N> uint8_t getChecksum(byte (&buffer)[N]){
+    uint8_t checksum = 0;
+    for(size_t i = 0; i < N - 1; i++){
+        checksum += buffer[i];
+    }
+    return checksum;
+}
+
+#endif
@@ -1,60 +1,135 @@
-
 #include "PicoEspTime.h"
-#include <time.h>                       // time() ctime()
 #include <sys/time.h>                   // struct timeval
+#include <hardware/timer.h>             // time_us_64()
+#include <hardware/sync.h>              // save_and_disable_interrupts()
 
-
-time_t now;
+/*!
+    refresh the calendar fields (UTC), they are only recomputed once the second has changed
+*/
 
 void PicoEspTime::read() {
-  struct timeval tv;
-  gettimeofday(&tv, nullptr);
-  now = time(nullptr);
-  struct tm* p_tm = localtime(&now);
-    second     = p_tm->tm_sec;
-    minute     = p_tm->tm_min;
-    hour       = p_tm->tm_hour;
-    dayOfWeek  = p_tm->tm_wday;
-    dayOfMonth = p_tm->tm_mday;
-    month      = p_tm->tm_mon;
-    year       = p_tm->tm_year+1900;
+  int64_t epoch = getEpoch();
+  if(epoch == cachedEpoch) return;
+  cachedEpoch = epoch;
+
+  breakTime(epoch, cachedTm);
+  second     = cachedTm.tm_sec;
+  minute     = cachedTm.tm_min;
+  hour       = cachedTm.tm_hour;
+  dayOfWeek  = cachedTm.tm_wday;
+  dayOfMonth = cachedTm.tm_mday;
+  month      = cachedTm.tm_mon;
+  year       = cachedTm.tm_year+1900;
 }
 
 /*!
-    get the time as an Arduino String object with the specified format
+    write the time of the last read() with the specified format into buffer, returns the number of characters written (0 if it did not fit)
 	https://www.cplusplus.com/reference/ctime/tm/
 	https://www.cplusplus.com/reference/ctime/strftime/
 */
 
-String PicoEspTime::getTime(String format){
-  char s[128];
-  char c[128];
-  format.toCharArray(c, 127);
-  struct tm* timeinfo = localtime(&now);
-  strftime(s, 127, c, timeinfo);
-  return String(s);
+size_t PicoEspTime::getTime(char* buffer, size_t length, const char* format){
+  return strftime(buffer, length, format, &cachedTm);
+}
+
+uint64_t PicoEspTime::getMonotonicMicros() {
+  return time_us_64();
+}
+
+int64_t PicoEspTime::getEpochMicros() {
+  return (int64_t)time_us_64() + getOffset();
 }
-long PicoEspTime::getEpoch() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec;
+
+int64_t PicoEspTime::getEpoch() {
+  int64_t us = getEpochMicros();
+  // floor division, times before 1970 stay consistent with breakTime
+  return (us >= 0) ? us / 1000000 : -((-us + 999999) / 1000000);
 }
 
 void PicoEspTime::adjust(uint8_t _hour, uint8_t _minute, uint8_t _second, uint16_t _year, uint8_t _month, uint8_t _day) {
-  struct tm t = {0};        // Initalize to all 0's
-  t.tm_year = _year - 1900;    // This is year-1900, so 122 = 2022
-  t.tm_mon = _month - 1;
-  t.tm_mday = _day;
-  t.tm_hour = _hour;
-  t.tm_min = _minute;
-  t.tm_sec = _second;
-  time_t timeSinceEpoch = mktime(&t);
-  adjust(timeSinceEpoch);
-}
-
-void PicoEspTime::adjust(long epoch) {
+  adjust(makeTime(_year, _month, _day, _hour, _minute, _second));
+}
+
+void PicoEspTime::adjust(int64_t epoch) {
+  adjustMicros(epoch * 1000000);
+}
+
+void PicoEspTime::adjustMicros(int64_t epochMicros) {
+  setOffset(epochMicros);
+
+#ifdef ARDUINO
+  // keep time() in line for the code that still uses the system clock, not done on the host where that is the clock of the machine
   struct timeval tv;
-  tv.tv_sec = epoch;  // epoch time (seconds)
-  tv.tv_usec = 0;    // microseconds
+  tv.tv_sec = epochMicros / 1000000;
+  tv.tv_usec = epochMicros % 1000000;
   settimeofday(&tv, NULL);
-}
\ No newline at end of file
+#endif
+}
+
+/*!
+    take over the system clock, after it was set from outside (e.g. by sntp)
+*/
+
+void PicoEspTime::sync() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  setOffset((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+// 64 bit loads and stores are not atomic on the M0+, neither side may be interrupted by the other.
+// save/restore instead of noInterrupts()/interrupts() so calling them from an interrupt handler does not unmask it.
+void PicoEspTime::setOffset(int64_t epochMicros) {
+  uint32_t status = save_and_disable_interrupts();
+  offsetMicros = epochMicros - (int64_t)time_us_64();
+  restore_interrupts(status);
+}
+
+int64_t PicoEspTime::getOffset() {
+  uint32_t status = save_and_disable_interrupts();
+  int64_t offset = offsetMicros;
+  restore_interrupts(status);
+  return offset;
+}
+
+/*!
+    calendar conversions without localtime()/mktime(), those go through the newlib reentrancy struct and may allocate
+	http://howardhinnant.github.io/date_algorithms.html
+*/
+
+void PicoEspTime::breakTime(int64_t epoch, struct tm& t) {
+  int64_t days = (epoch >= 0) ? epoch / 86400 : -((-epoch + 86399) / 86400);
+  int32_t secs = epoch - days * 86400;
+
+  t.tm_hour = secs / 3600;
+  t.tm_min = (secs % 3600) / 60;
+  t.tm_sec = secs % 60;
+  t.tm_wday = ((days % 7) + 11) % 7; // 1970-01-01 was a thursday
+
+  int64_t z = days + 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  uint32_t doe = z - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  int64_t y = yoe + era * 400;
+
+  t.tm_mday = doy - (153 * mp + 2) / 5 + 1;
+  t.tm_mon = (mp < 10) ? mp + 2 : mp - 10;
+  if(t.tm_mon <= 1) y++;
+  t.tm_year = y - 1900;
+
+  bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+  t.tm_yday = (doy + (leap ? 60 : 59)) % (leap ? 366 : 365);
+  t.tm_isdst = 0;
+}
+
+int64_t PicoEspTime::makeTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+  int32_t y = year - (month <= 2);
+  int32_t era = y / 400; // years before 0 are not needed here
+  uint32_t yoe = y - era * 400;
+  uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+  return days * 86400 + hour * 3600 + minute * 60 + second;
+}
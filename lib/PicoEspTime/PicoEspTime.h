@@ -1,16 +1,24 @@
-
-
 #ifndef PICOESPTIME_H
 #define PICOESPTIME_H
 
 #include <Arduino.h>
+#include <time.h>
+
+/*!
+    Wall clock on top of the 64 bit microsecond timer of the RP2040.
+    The time is the timer value plus an offset to UTC, adjust() and sync() replace the offset.
+    The offset is only read and written with interrupts masked, getEpoch(), getEpochMicros(), getMonotonicMicros(),
+    adjust() and sync() are safe to use in interrupts. read() and getTime() share the calendar fields, only use them from the loop.
+*/
 
 class PicoEspTime {
 public:
     void read();
-    String getTime(String format);
-    void adjust(long epoch);
+    size_t getTime(char* buffer, size_t length, const char* format);
+    void adjust(int64_t epoch);
     void adjust(uint8_t _hour, uint8_t _minute, uint8_t _second, uint16_t _year, uint8_t _month, uint8_t _day);
+    void adjustMicros(int64_t epochMicros);
+    void sync();
 
     uint8_t second;
     uint8_t minute;
@@ -19,7 +27,20 @@ public:
     uint8_t dayOfMonth;
     uint8_t month;
     uint16_t year;
-    long getEpoch();
+    int64_t getEpoch();
+    int64_t getEpochMicros();
+    uint64_t getMonotonicMicros();
+
+    static void breakTime(int64_t epoch, struct tm& t);
+    static int64_t makeTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+
+private:
+    void setOffset(int64_t epochMicros);
+    int64_t getOffset();
+
+    volatile int64_t offsetMicros = 0; // UTC in microseconds minus the timer value
+    int64_t cachedEpoch = -1; // second the calendar fields were computed for
+    struct tm cachedTm = {};
 };
 
 #endif
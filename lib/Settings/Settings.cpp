@@ -0,0 +1,74 @@
+#include "Settings.h"
+#include <FlatJson.h>
+
+// same rules as the captive portal form, out of range time zone values are clamped
+uint8_t validateSettings(settings& s, uint8_t numTimezones)
+{
+  if(s.ssidLength > 32 || s.passLength > 32){
+    return settings_too_long;
+  }
+  if(s.isProtected && s.passLength < 8){
+    return settings_pass_too_short;
+  }
+  s.timezoneIdx = min((int)s.timezoneIdx, numTimezones - 1);
+  s.gmtOffset = max(-12, min((int)s.gmtOffset, 12));
+  return settings_ok;
+}
+
+struct json_settings_request {
+  settings& new_settings;
+  uint8_t numTimezones;
+  uint8_t error;
+};
+
+static void handleSettingsField(const char* key, const char* value, bool quoted, void* context)
+{
+  json_settings_request& request = *(json_settings_request*)context;
+  if(request.error != settings_ok) return; // report the first problem
+  bool isTrue = !quoted && strcmp(value, "true") == 0;
+  bool isBool = isTrue || (!quoted && strcmp(value, "false") == 0);
+  char* end;
+
+  if(strcmp(key, "ssid") == 0 && quoted){
+    if(strlen(value) > 32) request.error = settings_too_long;
+    request.new_settings.setSSID(value, strlen(value));
+  }else if(strcmp(key, "pass") == 0 && quoted){
+    if(strlen(value) > 32) request.error = settings_too_long;
+    if(value[0] != '\0') request.new_settings.setPass(value, strlen(value));
+  }else if(strcmp(key, "protected") == 0 && isBool){
+    request.new_settings.isProtected = isTrue;
+  }else if(strcmp(key, "use_gmt_offset") == 0 && isBool){
+    request.new_settings.useGmtOffset = isTrue;
+  }else if(strcmp(key, "timezone") == 0 && !quoted){
+    long idx = strtol(value, &end, 10);
+    if(*end != '\0') request.error = settings_malformed;
+    request.new_settings.timezoneIdx = max(0L, min(idx, (long)request.numTimezones - 1));
+  }else if(strcmp(key, "gmt_offset") == 0 && !quoted){
+    long offset = strtol(value, &end, 10);
+    if(*end != '\0') request.error = settings_malformed;
+    request.new_settings.gmtOffset = max(-12L, min(offset, 12L));
+  }else{
+    request.error = settings_malformed; // unknown key or wrong type
+  }
+}
+
+/*!
+    applies a json body ({"ssid":"..","pass":"..","protected":true,"timezone":0,"use_gmt_offset":false,"gmt_offset":0}) to s
+    and validates the result, s is only usable if settings_ok is returned
+*/
+uint8_t parseSettingsJson(const char* body, size_t length, settings& s, uint8_t numTimezones)
+{
+  json_settings_request request = {s, numTimezones, settings_ok};
+
+  FlatJsonParser parser(handleSettingsField, &request);
+  parser.feed(body, length);
+
+  if(!parser.finish()){
+    // only an overlong value is too long, an overlong key can not be a known one
+    return (parser.error() == flatjson_too_long) ? settings_too_long : settings_malformed;
+  }
+  if(request.error != settings_ok){
+    return request.error;
+  }
+  return validateSettings(s, numTimezones);
+}
@@ -0,0 +1,72 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+
+/*!
+    Wifi and time zone settings as stored in the eeprom, with the validation shared by
+    the captive portal form, the json api and the i2c provisioning.
+*/
+
+struct settings {
+  uint8_t ssidLength; //1 byte
+  uint8_t passLength; //1 byte
+  char ssid[33] = {}; //33 bytes
+  char pass[33] = {}; //33 bytes
+  bool isProtected; //1 byte
+  bool useGmtOffset; //1 byte
+  int8_t gmtOffset; //1 byte
+  uint8_t timezoneIdx; //1 byte
+
+  settings(const char* ssidStr, const char* passStr, bool isPr, bool uGO, int8_t gO, uint8_t tzIDX)
+  {
+    setSSID(ssidStr, strlen(ssidStr));
+    setPass(passStr, strlen(passStr));
+
+    isProtected = isPr;
+    useGmtOffset = uGO;
+    gmtOffset = gO;
+    timezoneIdx = tzIDX;
+  }
+
+  void setSSID(const char* str, size_t length) {
+    // Ensure we don't write past the end of the buffer, the rest stays zeroed so the string is terminated
+    ssidLength = min(length, (size_t)32);
+    memset(ssid, 0, sizeof(ssid));
+    memcpy(ssid, str, ssidLength);
+  }
+
+  void setPass(const char* str, size_t length) {
+    passLength = min(length, (size_t)32);
+    memset(pass, 0, sizeof(pass));
+    memcpy(pass, str, passLength);
+  }
+
+  const char* getSSID() const {
+    return ssid;
+  }
+
+  const char* getPass() const {
+    return pass;
+  }
+
+  // the eeprom content is not trusted, clamps the lengths and terminates the strings
+  void sanitize() {
+    ssidLength = min(ssidLength, (uint8_t)32);
+    passLength = min(passLength, (uint8_t)32);
+    ssid[ssidLength] = '\0';
+    pass[passLength] = '\0';
+  }
+
+  int toPrintable(char* buffer, size_t length) const {
+    return snprintf(buffer, length, "SSID:%s Pass:%s isProtected:%d useGmtOffset:%d gmtOffset:%d timezoneIdx:%d",
+                    ssid, pass, isProtected, useGmtOffset, gmtOffset, timezoneIdx);
+  }
+};
+
+enum settings_error {settings_ok = 0, settings_pass_too_short = 1, settings_too_long = 2, settings_malformed = 3};
+
+uint8_t validateSettings(settings& s, uint8_t numTimezones);
+uint8_t parseSettingsJson(const char* body, size_t length, settings& s, uint8_t numTimezones);
+
+#endif
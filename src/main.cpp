@@ -7,6 +7,10 @@
 #include <lwip/apps/sntp.h>
 #include <EEPROM.h>
 #include <Timezone.h>
+#include <Updater.h>
+#include <HeapProbe.h>
+#include <Settings.h>
+#include <I2cProtocol.h>
 
 #define DEBUG false
 
@@ -14,12 +18,19 @@
 #define MAX_NTP_TIMEOUT 1800 //max timeout in seconds
 #define MAX_NTP_TIME_VALIDITY 3600 //max time validity in seconds
 
-#define MAX_COMMAND_LENGTH 5 //max length of a command data in bytes, used for checksum buffer
-#define REPLY_LENGTH 5 //length of the reply in bytes
+#define BUS_IDLE_CHECK_US 120 //SCL and SDA have to stay high this long before the bus is taken over, 3 clock periods at 25kHz
+
+#define MAX_SCAN_RESULTS 16 //number of networks kept from a wifi scan, strongest first
+#define REBOOT_DELAY_MS 3000 //time for the browser to receive the update result before the access point goes down
+#define MIN_SCAN_INTERVAL_MS 20000 //min time between two wifi scans, a scan briefly takes the radio away from the access point
 
 const int I2C_SDA_PIN = 8;
 const int I2C_SCL_PIN = 9;
 const int I2C_ADDRESS = 40;
+const int I2C_CLOCK = 25000;
+const int I2C_GENERAL_CALL_ADDRESS = 0;
+const byte I2C_HARDWARE_GENERAL_CALL = (I2C_ADDRESS << 1) | 1; //second byte of a hardware general call, the address of the sending master with the lsb set
+const byte TIME_FRAME_TYPE = 0x54; //first byte of a pushed time frame, tells it apart from the commands of the master controller
 
 const String ACCESS_POINT_NAME = "ClockClock";
 const String ACCESS_POINT_PASSWORD = "vierundzwanzig";
@@ -35,15 +46,26 @@ enum DeviceState {
   STATE_NTP_POLLING
 };
 DeviceState currentState = STATE_IDLE;
+volatile DeviceState requestedState = STATE_IDLE; //set by i2c commands, applied in loop()
+volatile bool state_change_flag = false;
 
 NTPClass ntp_service;
 bool poll_successfull = false;
-time_t poll_starttime = 0;
+uint64_t poll_start_us = 0;
 uint16_t poll_timeout = 60;
 uint16_t ntp_time_validity = 60;
-long expiry_time;
+uint64_t expiry_us = 0; //monotonic like last_sync_us, sntp and adjust() move the wall clock
+int64_t last_sync_us = -1; //monotonic time of the last successful poll, -1 if there was none since boot
 
 bool reset_data_flag = false;
+bool provision_commit_flag = false;
+bool reboot_flag = false;
+unsigned long reboot_at = 0; //millis() after which the reboot happens, the portal keeps running until then
+
+bool update_failed = false;
+unsigned long update_start_ms = 0;
+unsigned long update_duration_ms = 0;
+unsigned long update_max_stall_us = 0; //longest flash write of the last upload, upper bound of how long the i2c interrupt was blocked
 
 PicoEspTime rtc;
 
@@ -54,94 +76,69 @@ uint8_t wifi_feedback = not_yet_attempted;
 //idk how to name, keeps track during one ntp cycle, this value gets passed on to wifi_feedback on timeout, but NOT on cancel
 uint8_t wifi_feedback_2 = not_yet_attempted; 
 
+volatile uint8_t provision_feedback = not_yet_attempted; //result of the last provisioning commit of provision_transfer
+
+enum reply_identifier {reply_time = 0, reply_provision = 1};
+volatile uint8_t next_reply = reply_time; //what the next i2c request gets answered with
+uint8_t provision_read_seq = 0;
+
+enum distribution_mode {distribution_off = 0, distribution_list = 1, distribution_broadcast = 2};
+volatile uint8_t time_distribution = distribution_off;
+uint8_t distribution_addresses[MAX_DISTRIBUTION_ADDRESSES];
+uint8_t num_distribution_addresses = 0;
+int64_t last_distributed_epoch = 0;
+uint8_t distribution_feedback = not_yet_attempted; //result of the last push, fail if the bus was busy, a controller did not get the frame or the address list was rejected
+
+struct scan_result {
+  char ssid[33]; //null terminated
+  int8_t rssi; //dBm
+  bool isProtected;
+};
+scan_result scan_results[MAX_SCAN_RESULTS];
+uint8_t num_scan_results = 0;
+bool scan_running = false;
+unsigned long last_scan_start = 0;
+
 void startCaptivePortal();
 void handleCredentials();
 void handleCaptive();
+void handleNetworks();
+void handleApiStatus();
+void handleApiSettings();
+void handleUpdatePage();
+void handleUpdateUpload();
+void handleUpdateDone();
+void startWifiScan();
+void requestWifiScan();
+void handleWifiScan();
+void appendHtmlEscaped(String& out, const char* str);
+void appendJsonEscaped(String& out, const char* str);
 void startNtpPoll();
 void stopCaptivePortal();
 void cancelNtpPoll();
 void PrintTime();
+void PrintSettings();
 void saveDataEEPROM();
 void readDataEEPROM();
 void resetData();
+void commitProvisioning();
+void setCurrentSettings(const settings& s);
 void changeState(DeviceState newState);
+uint8_t transitionPath(DeviceState newState);
 void handleNtpPolling();
 void i2c_receive(int numBytesReceived);
 void i2c_request();
-bool verifyChecksum(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength);
-uint8_t getChecksum(byte (&buffer)[REPLY_LENGTH]);
+void i2c_request_provision();
+void startI2cSlave();
+void distributeTime();
+bool isBusIdle();
+bool isNack(uint8_t result);
+void getTimeReply(byte (&buffer)[REPLY_LENGTH]);
 
 #pragma region settings
 
 const int ADDRESS_SETTINGS = 1; //32 bytes
 
-struct settings {
-  uint8_t ssidLength; //1 byte
-  uint8_t passLength; //1 byte
-  char ssid[33] = {}; //33 bytes
-  char pass[33] = {}; //33 bytes
-  bool isProtected; //1 byte
-  bool useGmtOffset; //1 byte
-  int8_t gmtOffset; //1 byte
-  uint8_t timezoneIdx; //1 byte
-
-  settings(String ssidStr, String passStr, bool isPr, bool uGO, int8_t gO, uint8_t tzIDX)
-  {
-    ssidLength = ssidStr.length();
-    passLength = passStr.length();
-    
-    setSSIDString(ssidStr);
-    setPassString(passStr);
-
-    isProtected = isPr;
-    useGmtOffset = uGO;
-    gmtOffset = gO;
-    timezoneIdx = tzIDX;
-  }
-
-  void setSSIDString(String ssidStr) {
-    // Ensure we don't write past the end of the buffer
-    ssidLength = min((int)ssidStr.length(), 32); 
-    // Copy the string and add the null terminator
-    ssidStr.toCharArray(ssid, ssidLength + 1); 
-  }
-
-    void setPassString(String passStr) {
-    passLength = min((int)passStr.length(), 32);
-    passStr.toCharArray(pass, passLength + 1);
-  }
-
-  String getSSIDString(){
-    char ssid_str[ssidLength + 1];
-
-    for (int i = 0; i < ssidLength; i++) {
-      ssid_str[i] = ssid[i];
-    }
-
-    ssid_str[ssidLength] = '\0';
-
-    return String(ssid_str);
-  }
-
-  String getPassString(){
-    char pass_str[passLength + 1];
-
-    for (int i = 0; i < passLength; i++) {
-      pass_str[i] = pass[i];
-    }
-
-    pass_str[passLength] = '\0';
-
-    return String(pass_str);
-  }
-
-  String getPrintableString(){
-    String ssid = getSSIDString();
-    String pass = getPassString();
-    return "SSID:" + ssid + " Pass:" + pass + " isProtected:" + isProtected + " useGmtOffset:" + useGmtOffset + " gmtOffset:" + gmtOffset + " timezoneIdx:" + timezoneIdx;
-  }
-};
-
 settings DEFAULT_SETTINGS = settings("Wifi", "12345678", false, false, 0, 0);
 settings current_settings = DEFAULT_SETTINGS;
 
@@ -197,25 +194,17 @@ const int NUM_TIMEZONES = 9;
 
 #pragma region i2c command datastructs
 
-enum cmd_identifier {enable_ap = 0, poll_ntp = 1, reset_data = 2};
-
-#pragma pack(push, 1) // exact fit - no padding
-
-struct cmd_enable_ap_data {
-  uint8_t cmd_id;
-  bool enable; //1bytes # true enables the acces point for configuration, false disables it
-};
-
-struct cmd_poll_ntp_data {
-  uint8_t cmd_id;
-  uint16_t ntp_timeout; //2bytes, timeout in s
-  uint16_t ntp_time_validity; //2bytes, how long the retrieved time will be valid
-};
-
-#pragma pack(pop)
-
 cmd_enable_ap_data enable_ap_data;
 cmd_poll_ntp_data poll_ntp_data;
+cmd_provision_chunk_data provision_chunk_data;
+cmd_provision_read_data provision_read_data;
+cmd_set_distribution_data set_distribution_data;
+
+byte provision_buffer[PROVISION_NUM_CHUNKS * PROVISION_CHUNK_LENGTH];
+provision_payload provision_committed; //copy taken when the commit arrives, a new transfer can not change it before loop() stores it
+volatile uint8_t provision_transfer = 0; //counts the transfers started with seq 0, provision_feedback belongs to the latest one
+uint8_t provision_committed_transfer = 0; //transfer provision_committed was taken from
+volatile uint8_t provision_next_seq = PROVISION_SEQ_INVALID; //next expected chunk, invalid until a transfer starts with seq 0
 
 #pragma endregion
 
@@ -251,7 +240,8 @@ const String CAPTIVE_FORM_HTML = R"rawliteral(<body>
     <form action="/credentials" method="POST">
       <label class="biglabel" >Wi-Fi Daten:</label>
       <br>
-      <input class="textbox" type="text" name="wifissid" id="wifissid" placeholder="Wi-Fi SSID" value="*<*SSID*>*">
+      <input class="textbox" type="text" name="wifissid" id="wifissid" placeholder="Wi-Fi SSID" value="*<*SSID*>*" list="ssid_list" autocomplete="off" onchange="selectNetwork()">
+      <datalist id="ssid_list">*<*SSID_LIST*>*</datalist>
       <br>
       <input class="textbox" type="text" name="wifipass" id="wifipass" placeholder="Passwort unverändert">
       <label class="smalllabel"><input type="checkbox" name="is_protected" id="is_protected" onclick="enableFields()" *<*IS_PROT*>*/> Geschütztes Netzwerk</label>
@@ -292,7 +282,32 @@ function enableFields() {
   }
 }
 
-window.onload = enableFields;
+function selectNetwork() {
+  var opt = document.querySelector('#ssid_list option[value="' + CSS.escape(document.getElementById("wifissid").value) + '"]');
+  if (opt) {
+    document.getElementById("is_protected").checked = opt.dataset.prot == "1";
+    enableFields();
+  }
+}
+
+function refreshNetworks() {
+  fetch("/networks").then(function(r) { return r.json(); }).then(function(networks) {
+    var list = document.getElementById("ssid_list");
+    list.innerHTML = "";
+    networks.forEach(function(n) {
+      var opt = document.createElement("option");
+      opt.value = n.ssid;
+      opt.dataset.prot = n.prot ? "1" : "0";
+      opt.label = n.rssi + " dBm" + (n.prot ? ", geschützt" : "");
+      list.appendChild(opt);
+    });
+  }).catch(function() {});
+}
+
+window.onload = function() {
+  enableFields();
+  setInterval(refreshNetworks, 15000);
+};
 </script>
 </html>)rawliteral";
 
@@ -312,6 +327,44 @@ const String CAPTIVE_SUCCESS_HTML = R"rawliteral(<body>
   </div>
 </body></html>)rawliteral";
 
+const String CAPTIVE_UPDATE_HTML = R"rawliteral(<body>
+  <div>
+    <h1>UhrUhr24</h1>
+    <p>Firmware aktualisieren:</p>
+    <form id="update_form" method="POST" enctype="multipart/form-data" onsubmit="return prepareUpload()">
+      <input class="textbox" type="file" name="firmware" id="firmware" accept=".bin,.gz">
+      <br>
+      <input class="textbox" type="text" name="md5" id="md5" placeholder="MD5 Prüfsumme" pattern="[0-9a-fA-F]{32}" required>
+      <input type="submit" value="Hochladen">
+    </form><br>
+  </div>
+</body>
+<script>
+function prepareUpload() {
+  var file = document.getElementById("firmware").files[0];
+  if (!file) return false;
+  var action = "/update?size=" + file.size;
+  var md5 = document.getElementById("md5").value.trim();
+  if (md5 == "") return false;
+  action += "&md5=" + encodeURIComponent(md5);
+  document.getElementById("update_form").action = action;
+  return true;
+}
+</script>
+</html>)rawliteral";
+
+const String CAPTIVE_UPDATE_SUCCESS_HTML = R"rawliteral(<body>
+  <div>
+    <h1>UhrUhr24</h1>
+    <p>Firmware erfolgreich hochgeladen, das Modul startet neu.</p>
+    <p></p>
+    <p>Größe: *<*SIZE*>* Bytes</p>
+    <p>Übertragung: *<*RATE*>* kB/s</p>
+    <p>MD5: *<*MD5*>*</p>
+    <p>I2C blockiert: max. *<*STALL*>* ms</p>
+  </div>
+</body></html>)rawliteral";
+
 const String CAPTIVE_ERROR_HTML = R"rawliteral(<body>
   <div>
     <h1>UhrUhr24</h1>
@@ -342,13 +395,13 @@ void setup() {
 
   Wire.setSCL(I2C_SCL_PIN);
   Wire.setSDA(I2C_SDA_PIN);  
-  Wire.setClock(25000); 
-  Wire.begin(I2C_ADDRESS); 
-  Wire.onReceive(i2c_receive);
-  Wire.onRequest(i2c_request);
+  startI2cSlave();
 
   // Initialize in IDLE state
   currentState = STATE_IDLE;
+
+  // the allocations of the setup are not part of any runtime path
+  HeapProbe::reset();
 }
 
 void loop() {
@@ -358,6 +411,7 @@ void loop() {
   if(reset_data_flag){
     reset_data_flag = false;
     DeviceState stateBeforeReset = currentState;
+    HeapProbeScope probe(transitionPath(stateBeforeReset));
     
     changeState(STATE_IDLE); // Stop current activity
     resetData();
@@ -368,35 +422,89 @@ void loop() {
     }
   }
 
+  // State change requested over i2c, the radio is started and stopped here and not in the interrupt
+  if(state_change_flag){
+    state_change_flag = false;
+    DeviceState newState = requestedState;
+    HeapProbeScope probe(transitionPath(newState));
+    changeState(newState);
+  }
+
+  // Firmware update staged, reboot so the bootloader can apply it
+  if(reboot_flag && (long)(millis() - reboot_at) >= 0){
+    if(DEBUG) Serial.println("rebooting to apply update");
+    HeapProbeScope probe(transitionPath(STATE_IDLE));
+    changeState(STATE_IDLE);
+    delay(100);
+    rp2040.reboot();
+  }
+
+  // Provisioning over i2c finished, validate and store outside of the interrupt
+  if(provision_commit_flag){
+    provision_commit_flag = false;
+    commitProvisioning();
+  }
+
+  // Push the time to the controllers right after the second changed
+  if(time_distribution != distribution_off){
+    int64_t epoch = rtc.getEpoch();
+    if(epoch != last_distributed_epoch){
+      last_distributed_epoch = epoch;
+      distributeTime();
+    }
+  }
+
   // Main state machine handler
   switch (currentState) {
     case STATE_IDLE:
       // Nothing to do in a loop
       break;
-    case STATE_AP_MODE:
+    case STATE_AP_MODE: {
+      HeapProbeScope probe(HEAP_PATH_PORTAL);
       dnsServer.processNextRequest();
       webServer.handleClient();
+      handleWifiScan();
       break;
-    case STATE_NTP_POLLING:
+    }
+    case STATE_NTP_POLLING: {
+      HeapProbeScope probe(HEAP_PATH_NTP);
       handleNtpPolling();
       break;
+    }
   }
 
   // This check is independent of the main state
-  if(poll_successfull && (time(nullptr) > expiry_time)){
+  if(poll_successfull && (rtc.getMonotonicMicros() > expiry_us)){
     if(DEBUG) Serial.println("Invalidating ntp time since timeout has been reached");
     poll_successfull = false;
     if(currentState == STATE_NTP_POLLING){
+      HeapProbeScope probe(HEAP_PATH_NTP);
       changeState(STATE_IDLE);
     }
   }
+
+  // The i2c handlers and the idle loop have to run without touching the heap, a long running device would fragment it
+  if(DEBUG && (HeapProbe::get(HEAP_PATH_I2C).allocations > 0 || HeapProbe::get(HEAP_PATH_IDLE).allocations > 0)){
+    Serial.println("heap allocation in i2c or idle path");
+    HeapProbe::print(Serial);
+    HeapProbe::reset();
+  }
 }
 
 void PrintTime()
 { 
-  if(DEBUG) Serial.println(rtc.getTime("%A, %B %d %Y %H:%M:%S"));
+  char buffer[64];
+  rtc.getTime(buffer, sizeof(buffer), "%A, %B %d %Y %H:%M:%S");
+  if(DEBUG) Serial.println(buffer);
 } 
 
+void PrintSettings()
+{
+  char buffer[128];
+  current_settings.toPrintable(buffer, sizeof(buffer));
+  if(DEBUG) Serial.println(buffer);
+}
+
 #pragma endregion
 
 #pragma region state machine
@@ -421,6 +529,14 @@ void changeState(DeviceState newState) {
   currentState = newState;
 }
 
+// starting and stopping the radio allocates, a transition from loop() counts towards the state it starts or stops
+uint8_t transitionPath(DeviceState newState) {
+  DeviceState activeState = (newState != STATE_IDLE) ? newState : currentState;
+  if (activeState == STATE_AP_MODE) return HEAP_PATH_PORTAL;
+  if (activeState == STATE_NTP_POLLING) return HEAP_PATH_NTP;
+  return HEAP_PATH_IDLE;
+}
+
 void handleNtpPolling() {
   // A known, recent timestamp (Jan 1, 2024). Time is valid if it's after this.
   const unsigned long MIN_VALID_EPOCH = 1704067200UL; 
@@ -437,14 +553,16 @@ void handleNtpPolling() {
       ntp_feedback = success;
       poll_successfull = true;
       if(DEBUG) Serial.println(("Succesfully polled, time will be valid for (s)" + String(ntp_time_validity)));
+      rtc.sync(); // sntp sets the system clock, move it over to the timer based clock
+      last_sync_us = rtc.getMonotonicMicros();
       rtc.read();
       PrintTime();
-      expiry_time = time(nullptr) + ntp_time_validity;
+      expiry_us = rtc.getMonotonicMicros() + (uint64_t)ntp_time_validity * 1000000;
     }
   }
 
   // Check for timeout or success to end the polling state
-  if(time(nullptr) > (poll_starttime + poll_timeout) || poll_successfull){
+  if(rtc.getMonotonicMicros() > (poll_start_us + (uint64_t)poll_timeout * 1000000) || poll_successfull){
     if(!poll_successfull){
       ntp_feedback = fail;
     }
@@ -460,28 +578,79 @@ void handleNtpPolling() {
 #pragma region i2c handler
 
 void i2c_receive(int numBytesReceived) {
+  HeapProbeScope probe(HEAP_PATH_I2C);
   if(numBytesReceived >= 2 && numBytesReceived <= MAX_COMMAND_LENGTH + 1){
     byte buffer[MAX_COMMAND_LENGTH + 1];
     Wire.readBytes((byte*) &buffer, numBytesReceived);
-    if(verifyChecksum(buffer, numBytesReceived)){
-      uint8_t cmd_id = static_cast<uint8_t>(buffer[0]);
+    uint8_t cmd_id = decodeCommand(buffer, numBytesReceived);
+    if(cmd_id != cmd_invalid){
 
-      if (cmd_id == enable_ap && numBytesReceived == sizeof(enable_ap_data) + 1){
+      if (cmd_id == enable_ap){
         memcpy(&enable_ap_data, buffer, sizeof(enable_ap_data));
-        if (enable_ap_data.enable) {
-          changeState(STATE_AP_MODE);
-        } else {
-          changeState(STATE_IDLE);
-        }
-      } else if (cmd_id == poll_ntp && numBytesReceived == sizeof(poll_ntp_data) + 1){
+        requestedState = enable_ap_data.enable ? STATE_AP_MODE : STATE_IDLE;
+        state_change_flag = true;
+      } else if (cmd_id == poll_ntp){
         memcpy(&poll_ntp_data, buffer, sizeof(poll_ntp_data));
 
         poll_timeout = min((uint16_t)MAX_NTP_TIMEOUT, poll_ntp_data.ntp_timeout);
         ntp_time_validity = min((uint16_t)MAX_NTP_TIME_VALIDITY, poll_ntp_data.ntp_time_validity);
         
-        changeState(STATE_NTP_POLLING);
-      } else if (cmd_id == reset_data && numBytesReceived == 2){
+        requestedState = STATE_NTP_POLLING;
+        state_change_flag = true;
+      } else if (cmd_id == reset_data){
         reset_data_flag = true;
+      } else if (cmd_id == provision_chunk){
+        memcpy(&provision_chunk_data, buffer, sizeof(provision_chunk_data));
+
+        if(provision_chunk_data.seq == 0){
+          provision_next_seq = 0;
+          provision_transfer++;
+          provision_feedback = not_yet_attempted;
+        }
+        if(provision_chunk_data.seq == provision_next_seq && provision_chunk_data.seq < PROVISION_NUM_CHUNKS){
+          memcpy(&provision_buffer[provision_chunk_data.seq * PROVISION_CHUNK_LENGTH], provision_chunk_data.data, PROVISION_CHUNK_LENGTH);
+          provision_next_seq++;
+        } else {
+          // missed or repeated chunk, the transfer has to be restarted from seq 0
+          provision_next_seq = PROVISION_SEQ_INVALID;
+          provision_feedback = fail;
+        }
+      } else if (cmd_id == provision_commit){
+        if(provision_next_seq == PROVISION_NUM_CHUNKS){
+          memcpy(&provision_committed, provision_buffer, sizeof(provision_committed));
+          provision_committed_transfer = provision_transfer;
+          provision_next_seq = PROVISION_SEQ_INVALID;
+          provision_commit_flag = true;
+        } else {
+          provision_feedback = fail;
+        }
+      } else if (cmd_id == provision_read){
+        memcpy(&provision_read_data, buffer, sizeof(provision_read_data));
+        provision_read_seq = provision_read_data.seq;
+        next_reply = reply_provision;
+      } else if (cmd_id == set_distribution){
+        memcpy(&set_distribution_data, buffer, sizeof(set_distribution_data));
+
+        // the bus is only taken over from the loop, here the settings are just stored
+        uint8_t num_addresses = min(set_distribution_data.num_addresses, (uint8_t)MAX_DISTRIBUTION_ADDRESSES);
+        bool addressesValid = true;
+        for (int i = 0; i < num_addresses; i++){
+          addressesValid = addressesValid && isValidDistributionAddress(set_distribution_data.addresses[i], I2C_ADDRESS);
+        }
+        if(set_distribution_data.mode == distribution_list && !addressesValid){
+          distribution_feedback = fail; // reserved address or this module, the previous distribution stays active
+          return;
+        }
+
+        num_distribution_addresses = num_addresses;
+        memcpy(distribution_addresses, set_distribution_data.addresses, num_distribution_addresses);
+        if(set_distribution_data.mode == distribution_list && num_distribution_addresses > 0){
+          time_distribution = distribution_list;
+        } else if(set_distribution_data.mode == distribution_broadcast){
+          time_distribution = distribution_broadcast;
+        } else {
+          time_distribution = distribution_off;
+        }
       }
     }
   } else {
@@ -493,42 +662,128 @@ void i2c_receive(int numBytesReceived) {
 }
 
 void i2c_request() {
+  HeapProbeScope probe(HEAP_PATH_I2C);
+  if(next_reply == reply_provision){
+    next_reply = reply_time;
+    i2c_request_provision();
+    return;
+  }
+
   byte buffer[REPLY_LENGTH];
-  rtc.read();
-  time_t t = 0;
+  getTimeReply(buffer);
 
-  if (current_settings.useGmtOffset){
-    // ... (rest of the function is the same)
-  } else {
-    t = timezones[current_settings.timezoneIdx].toLocal(rtc.getEpoch());
-  }
+  Wire.write(buffer, REPLY_LENGTH);
+}
 
+// status and local time, answers a poll and is pushed to the controllers in distribution mode
+void getTimeReply(byte (&buffer)[REPLY_LENGTH]) {
   // Replace polling_ntp with a check of the current state
   uint8_t combined_bool = poll_successfull + ((currentState == STATE_NTP_POLLING) * 2);
 
-  buffer[0] = (byte)combined_bool;
-  buffer[1] = (byte)hour(t);
-  buffer[2] = (byte)minute(t);
-  buffer[3] = (byte)second(t);
-  buffer[4] = getChecksum(buffer);
+  getTimeReply(buffer, combined_bool, current_settings, timezones[current_settings.timezoneIdx], rtc.getEpoch());
+}
 
-  Wire.write(buffer, REPLY_LENGTH);
+void startI2cSlave() {
+  Wire.setClock(I2C_CLOCK); 
+  Wire.begin(I2C_ADDRESS); 
+  Wire.onReceive(i2c_receive);
+  Wire.onRequest(i2c_request);
 }
 
-bool verifyChecksum(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t bufferLength){
-    uint8_t checksum = 0;
-    for(int i = 0; i < bufferLength - 1; i++){
-        checksum += buffer[i];
+// Becomes bus master for one frame per controller (or one hardware general call), then goes back to being a slave.
+// The frame is TIME_FRAME_TYPE followed by the reply to a poll, so the controllers can parse it the same way.
+// A general call with an even second byte other than 0x04 and 0x06 may be ignored (UM10204), the broadcast is sent as
+// hardware general call: I2C_HARDWARE_GENERAL_CALL followed by the frame.
+// The master controller shares the bus, if it is busy or the arbitration is lost this second is skipped.
+// A controller that does not ack (powered off, wrong address) is recorded as failed, the others still get the frame.
+void distributeTime() {
+  byte reply[REPLY_LENGTH];
+  getTimeReply(reply);
+  byte frame[TIME_FRAME_LENGTH];
+  frame[0] = TIME_FRAME_TYPE;
+  memcpy(&frame[1], reply, REPLY_LENGTH);
+
+  if(!isBusIdle()){
+    distribution_feedback = fail;
+    if(DEBUG) Serial.println("bus busy, time not pushed");
+    return;
+  }
+
+  Wire.end();
+  Wire.setClock(I2C_CLOCK);
+  Wire.begin();
+
+  distribution_feedback = success;
+  if(time_distribution == distribution_broadcast){
+    Wire.beginTransmission(I2C_GENERAL_CALL_ADDRESS);
+    Wire.write(I2C_HARDWARE_GENERAL_CALL);
+    Wire.write(frame, TIME_FRAME_LENGTH);
+    uint8_t result = Wire.endTransmission();
+    if(result != 0){
+      distribution_feedback = fail;
+      if(DEBUG){
+        Serial.print("general call failed: ");
+        Serial.println(result);
+      }
     }
-    return checksum == buffer[bufferLength - 1];
+  } else {
+    for (int i = 0; i < num_distribution_addresses; i++){
+      Wire.beginTransmission(distribution_addresses[i]);
+      Wire.write(frame, TIME_FRAME_LENGTH);
+      uint8_t result = Wire.endTransmission();
+      if(result != 0){
+        distribution_feedback = fail;
+        if(DEBUG){
+          Serial.print("push to controller failed: ");
+          Serial.print(distribution_addresses[i]);
+          Serial.print(" ");
+          Serial.println(result);
+        }
+        if(!isNack(result)){
+          break; // the master controller has the bus now or the bus is stuck, try again next second
+        }
+      }
+    }
+  }
+
+  Wire.end();
+  startI2cSlave();
+}
+
+// 2 and 3 are the nacks of the arduino api, this core returns 4 for every abort of the sdk (nack and lost arbitration).
+// After a nack the transfer is over and the bus is free again, after lost arbitration the other master is still sending.
+bool isNack(uint8_t result) {
+  return result == 2 || result == 3 || (result == 4 && isBusIdle());
 }
 
-uint8_t getChecksum(byte (&buffer)[REPLY_LENGTH]){
-    uint8_t checksum = 0;
-    for(int i = 0; i < REPLY_LENGTH - 1; i++){
-        checksum += buffer[i];
+// true if SCL and SDA stay high for a few clock periods, nobody else is transferring
+bool isBusIdle() {
+  unsigned long start = micros();
+  while(micros() - start < BUS_IDLE_CHECK_US){
+    if(digitalRead(I2C_SCL_PIN) == LOW || digitalRead(I2C_SDA_PIN) == LOW){
+      return false;
     }
-    return checksum;
+  }
+  return true;
+}
+
+// reply to a provision_read command: feedback of the last commit, chunk index, chunk of the stored settings, checksum
+// the password is never read back (same as /api/status), only its length so the controller can check it
+void i2c_request_provision() {
+  byte buffer[PROVISION_REPLY_LENGTH] = {};
+  provision_payload payload;
+  settingsToPayload(current_settings, payload);
+  memset(payload.pass, 0, sizeof(payload.pass));
+
+  buffer[0] = provision_feedback;
+  buffer[1] = provision_read_seq;
+  if(provision_read_seq < PROVISION_NUM_CHUNKS){
+    size_t offset = provision_read_seq * PROVISION_CHUNK_LENGTH;
+    memcpy(&buffer[2], (byte*)&payload + offset, min((size_t)PROVISION_CHUNK_LENGTH, sizeof(payload) - offset));
+  }
+  buffer[PROVISION_REPLY_LENGTH - 1] = getChecksum(buffer);
+
+  Wire.write(buffer, PROVISION_REPLY_LENGTH);
 }
 
 #pragma endregion
@@ -543,14 +798,27 @@ void startCaptivePortal() {
   dnsServer.start(DNS_PORT, "*", apIP);
   
   webServer.on("/credentials", HTTP_POST, handleCredentials);
+  webServer.on("/networks", HTTP_GET, handleNetworks);
+  webServer.on("/api/status", HTTP_GET, handleApiStatus);
+  webServer.on("/api/settings", HTTP_POST, handleApiSettings);
+  webServer.on("/update", HTTP_GET, handleUpdatePage);
+  webServer.on("/update", HTTP_POST, handleUpdateDone, handleUpdateUpload);
   webServer.onNotFound(handleCaptive);
+  const char* collectedHeaders[] = {"Content-Type"};
+  webServer.collectHeaders(collectedHeaders, 1);
   webServer.begin();
+
+  startWifiScan(); // no client is connected yet, the first page already gets a list
 }
 
 void stopCaptivePortal() {
   if(DEBUG) Serial.println("stop ap");
   webServer.stop();
   dnsServer.stop();
+  if(scan_running){
+    WiFi.scanDelete();
+    scan_running = false;
+  }
   WiFi.softAPdisconnect(true);
   WiFi.mode(WIFI_OFF);
 }
@@ -559,64 +827,67 @@ void handleCredentials(){
   String msg = CAPTIVE_SUCCESS_HTML;
 
   if (webServer.hasArg("wifissid") && webServer.hasArg("wifipass") && webServer.hasArg("timezone") && webServer.hasArg("gmtOffset")){
+    // look every argument up once, arg() searches the argument list on every call
+    const String& ssidArg = webServer.arg("wifissid");
+    const String& passArg = webServer.arg("wifipass");
+    bool isProtected = webServer.hasArg("is_protected");
+    bool passUnchanged = passArg.length() == 0;
+
     if(DEBUG){
-      Serial.println(webServer.arg("wifissid"));
-      Serial.println(webServer.arg("wifipass"));
-      Serial.println(webServer.hasArg("is_protected"));
+      Serial.println(ssidArg);
+      Serial.println(passArg);
+      Serial.println(isProtected);
     }
 
-    String wifipass;
-    if(webServer.arg("wifipass") == ""){
-      wifipass = current_settings.getPassString();
-    }else{
-      wifipass = webServer.arg("wifipass");
+    settings new_settings = current_settings;
+    uint8_t error = settings_too_long;
+    if(ssidArg.length() <= 32 && passArg.length() <= 32){
+      new_settings.isProtected = isProtected;
+      new_settings.setSSID(ssidArg.c_str(), ssidArg.length());
+      if(!passUnchanged){
+        new_settings.setPass(passArg.c_str(), passArg.length());
+      }
+      new_settings.timezoneIdx = max(0L, min(webServer.arg("timezone").toInt(), (long)NUM_TIMEZONES - 1));
+      new_settings.useGmtOffset = webServer.hasArg("gmt_offset_enabled");
+      new_settings.gmtOffset = max(-12L, min(webServer.arg("gmtOffset").toInt(), 12L));
+      error = validateSettings(new_settings, NUM_TIMEZONES);
     }
 
-    if((webServer.hasArg("is_protected") && wifipass.length() >= 8) || !webServer.hasArg("is_protected")){
-      if(webServer.arg("wifissid").length() <= 32 && wifipass.length() <= 32){
-        current_settings.isProtected = webServer.hasArg("is_protected");
-        current_settings.setSSIDString(webServer.arg("wifissid"));
-        current_settings.setPassString(wifipass);
-        current_settings.timezoneIdx = max(0, min(webServer.arg("timezone").toInt(), NUM_TIMEZONES - 1));
-        current_settings.useGmtOffset = webServer.hasArg("gmt_offset_enabled");
-        current_settings.gmtOffset = max(-12, min(webServer.arg("gmtOffset").toInt(), 12));
-        
-        if (webServer.hasArg("is_protected")){
-          msg.replace("*<*PROT*>*", "Ja");
-        }else{
-          msg.replace("*<*PROT*>*", "Nein");
-          String a = R"rawliteral(<p>Passwort: *<*PASS*>*</p>)rawliteral";
-          msg.replace(a, "");
-        }
-        msg.replace("*<*SSID*>*", webServer.arg("wifissid"));
+    if(error == settings_ok){
+      setCurrentSettings(new_settings);
 
-        if(webServer.arg("wifipass") == ""){
-          msg.replace("*<*PASS*>*", "unverändert");
-        }else{
-          msg.replace("*<*PASS*>*", webServer.arg("wifipass"));
-        }
+      if (isProtected){
+        msg.replace("*<*PROT*>*", "Ja");
+      }else{
+        msg.replace("*<*PROT*>*", "Nein");
+        msg.replace("<p>Passwort: *<*PASS*>*</p>", "");
+      }
+      msg.replace("*<*SSID*>*", ssidArg);
 
-        if(current_settings.useGmtOffset){
-          String symbol = "";
-          if(current_settings.gmtOffset >= 0){
-            symbol = "+";
-          }
-          msg.replace("*<*TZ*>*", ("GMT" + symbol + String(current_settings.gmtOffset)));
-        }else{
-          msg.replace("*<*TZ*>*", timezoneNames[current_settings.timezoneIdx]);
-        }
-        
-        saveDataEEPROM();
+      if(passUnchanged){
+        msg.replace("*<*PASS*>*", "unverändert");
+      }else{
+        msg.replace("*<*PASS*>*", passArg);
       }
-      else{
-        msg = CAPTIVE_ERROR_HTML;
-        msg.replace("*<*Error*>*", "SSID und Passwort müssen je weniger als 33 Zeichen haben");
+
+      if(current_settings.useGmtOffset){
+        char tz[8];
+        snprintf(tz, sizeof(tz), "GMT%+d", current_settings.gmtOffset);
+        msg.replace("*<*TZ*>*", tz);
+      }else{
+        msg.replace("*<*TZ*>*", timezoneNames[current_settings.timezoneIdx]);
       }
+      
+      saveDataEEPROM();
     }
-    else{
+    else if(error == settings_pass_too_short){
       msg = CAPTIVE_ERROR_HTML;
       msg.replace("*<*Error*>*", "Passwort muss mehr als 7 Zeichen haben");
     }
+    else{
+      msg = CAPTIVE_ERROR_HTML;
+      msg.replace("*<*Error*>*", "SSID und Passwort müssen je weniger als 33 Zeichen haben");
+    }
   }
   else{
     msg = CAPTIVE_ERROR_HTML;
@@ -628,14 +899,23 @@ void handleCredentials(){
 
 void handleCaptive(){
   if(DEBUG) Serial.println("Serving Settings Page");
+  requestWifiScan();
   String form = CAPTIVE_FORM_HTML;
-  form.replace("*<*SSID*>*", current_settings.getSSIDString());
+  form.replace("*<*SSID*>*", current_settings.getSSID());
   if(current_settings.isProtected){
     form.replace("*<*IS_PROT*>*", "checked");
   }else{
     form.replace("*<*IS_PROT*>*", "");
   }
 
+  String ssidListItems = "";
+  for (int i = 0; i < num_scan_results; i++){
+    ssidListItems += "<option value=\"";
+    appendHtmlEscaped(ssidListItems, scan_results[i].ssid);
+    ssidListItems += "\" label=\"" + String(scan_results[i].rssi) + " dBm" + (scan_results[i].isProtected ? ", geschützt" : "") + "\" data-prot=\"" + String(scan_results[i].isProtected) + "\"></option>";
+  }
+  form.replace("*<*SSID_LIST*>*", ssidListItems);
+
   String tmzListItems = "";
   for (int i = 0; i < NUM_TIMEZONES; i++){
     if(current_settings.timezoneIdx == i){
@@ -679,6 +959,260 @@ void handleCaptive(){
   webServer.send(200, "text/html", (STYLE_HTML + form));
 }
 
+void handleNetworks(){
+  requestWifiScan(); // the page asks for the list periodically, the results arrive with a later request
+  String json = "[";
+  for (int i = 0; i < num_scan_results; i++){
+    if(i > 0) json += ",";
+    json += "{\"ssid\":\"";
+    appendJsonEscaped(json, scan_results[i].ssid);
+    json += "\",\"rssi\":" + String(scan_results[i].rssi) + ",\"prot\":" + String(scan_results[i].isProtected) + "}";
+  }
+  json += "]";
+
+  webServer.send(200, "application/json", json);
+}
+
+#pragma endregion
+
+#pragma region json api
+
+const char* STATE_NAMES[] = {"idle", "ap", "ntp"};
+const char* SETTINGS_ERROR_NAMES[] = {"ok", "pass_too_short", "too_long", "malformed"};
+
+// for scripted setup, the same information as the settings page without the html
+void handleApiStatus(){
+  String json = "{\"state\":\"" + String(STATE_NAMES[currentState]) + "\"";
+  json += ",\"wifi\":" + String(wifi_feedback);
+  json += ",\"ntp\":" + String(ntp_feedback);
+  json += ",\"provision\":" + String(provision_feedback);
+  json += ",\"distribution\":" + String(distribution_feedback);
+  json += ",\"time_valid\":" + String(poll_successfull ? "true" : "false");
+  json += ",\"sync_age\":" + String(last_sync_us < 0 ? -1L : (long)((rtc.getMonotonicMicros() - last_sync_us) / 1000000));
+
+  json += ",\"settings\":{\"ssid\":\"";
+  appendJsonEscaped(json, current_settings.getSSID());
+  json += "\",\"protected\":" + String(current_settings.isProtected ? "true" : "false");
+  json += ",\"timezone\":" + String(current_settings.timezoneIdx);
+  json += ",\"use_gmt_offset\":" + String(current_settings.useGmtOffset ? "true" : "false");
+  json += ",\"gmt_offset\":" + String(current_settings.gmtOffset) + "}";
+
+  json += ",\"timezones\":[";
+  for (int i = 0; i < NUM_TIMEZONES; i++){
+    if(i > 0) json += ",";
+    json += "\"";
+    appendJsonEscaped(json, timezoneNames[i]);
+    json += "\"";
+  }
+  json += "]}";
+
+  webServer.send(200, "application/json", json);
+}
+
+/*!
+    body: {"ssid":"..","pass":"..","protected":true,"timezone":0,"use_gmt_offset":false,"gmt_offset":0}
+    every field is optional, missing ones (and an empty pass) keep their current value
+    the body has to be sent as application/json, the web server parses any other body as form arguments:
+    curl -H 'Content-Type: application/json' -d @unit.json http://172.217.28.1/api/settings
+*/
+void handleApiSettings(){
+  if(!webServer.header("Content-Type").startsWith("application/json") || !webServer.hasArg("plain")){
+    webServer.send(415, "application/json", "{\"ok\":false,\"error\":\"content_type\"}");
+    return;
+  }
+
+  settings new_settings = current_settings;
+
+  // the body is fed through the parser without copying, every field lands in a fixed buffer
+  const String& body = webServer.arg("plain");
+  uint8_t error = parseSettingsJson(body.c_str(), body.length(), new_settings, NUM_TIMEZONES);
+  if(error == settings_ok){
+    setCurrentSettings(new_settings);
+    saveDataEEPROM();
+  }
+
+  if(DEBUG) Serial.println(SETTINGS_ERROR_NAMES[error]);
+  webServer.send(error == settings_ok ? 200 : 400, "application/json",
+                 String("{\"ok\":") + (error == settings_ok ? "true" : "false") + ",\"error\":\"" + SETTINGS_ERROR_NAMES[error] + "\"}");
+}
+
+#pragma endregion
+
+#pragma region firmware update
+
+void handleUpdatePage(){
+  if(DEBUG) Serial.println("Serving Update Page");
+  webServer.send(200, "text/html", (STYLE_HTML + CAPTIVE_UPDATE_HTML));
+}
+
+// The image is written to the staging area chunk by chunk as the upload arrives and is never held in ram.
+// The updater hashes every chunk it writes, end() compares against the md5 given by the client, an upload without one is rejected.
+// The i2c slave keeps serving from its interrupt in between, but flash is erased and programmed with XIP off and interrupts
+// masked, on every block LittleFS writes. For that time a poll is held by clock stretching and a command longer than the
+// 16 byte receive fifo (a provisioning chunk) can be lost and has to be repeated. The flash allows up to 400ms for one
+// sector erase, the longest write of each upload is measured and shown on the result page.
+void handleUpdateUpload(){
+  HTTPUpload& upload = webServer.upload();
+
+  if(upload.status == UPLOAD_FILE_START){
+    if(DEBUG) Serial.println("update start: " + upload.filename);
+    update_failed = false;
+    update_start_ms = millis();
+    update_max_stall_us = 0;
+
+    // the hash is not optional, without it a corrupted upload would be committed
+    uint32_t size = webServer.hasArg("size") ? webServer.arg("size").toInt() : 0;
+    if(size == 0 || !webServer.hasArg("md5") || !Update.begin(size)){
+      update_failed = true;
+      return;
+    }
+    if(!Update.setMD5(webServer.arg("md5").c_str())){
+      Update.end();
+      update_failed = true;
+    }
+  } else if(upload.status == UPLOAD_FILE_WRITE){
+    if(!update_failed){
+      unsigned long writeStart = micros();
+      size_t written = Update.write(upload.buf, upload.currentSize);
+      update_max_stall_us = max(update_max_stall_us, micros() - writeStart);
+      if(written != upload.currentSize){
+        update_failed = true;
+      }
+    }
+  } else if(upload.status == UPLOAD_FILE_END){
+    update_duration_ms = max(1UL, millis() - update_start_ms);
+    // only commits the image if the size and the hash match, otherwise the current firmware stays active
+    if(!update_failed){
+      unsigned long endStart = micros();
+      bool committed = Update.end();
+      update_max_stall_us = max(update_max_stall_us, micros() - endStart);
+      if(!committed){
+        update_failed = true;
+      }
+    }
+    if(DEBUG) Serial.println("update end: " + String(upload.totalSize) + " bytes in " + String(update_duration_ms) + " ms, longest flash write " + String(update_max_stall_us) + " us");
+  } else if(upload.status == UPLOAD_FILE_ABORTED){
+    Update.end();
+    update_failed = true;
+  }
+}
+
+void handleUpdateDone(){
+  String msg;
+
+  if(!update_failed && Update.isFinished()){
+    HTTPUpload& upload = webServer.upload();
+    msg = CAPTIVE_UPDATE_SUCCESS_HTML;
+    msg.replace("*<*SIZE*>*", String(upload.totalSize));
+    msg.replace("*<*RATE*>*", String((float)upload.totalSize / update_duration_ms, 1));
+    msg.replace("*<*MD5*>*", Update.md5String());
+    msg.replace("*<*STALL*>*", String((float)update_max_stall_us / 1000, 1));
+    reboot_flag = true;
+    reboot_at = millis() + REBOOT_DELAY_MS;
+  } else {
+    msg = CAPTIVE_ERROR_HTML;
+    if(Update.hasError()){
+      msg.replace("*<*Error*>*", "Update fehlgeschlagen, Code " + String(Update.getError()));
+    }else{
+      msg.replace("*<*Error*>*", "Update fehlgeschlagen");
+    }
+  }
+
+  webServer.send(200, "text/html", (STYLE_HTML + msg));
+}
+
+#pragma endregion
+
+#pragma region wifi scan
+
+void startWifiScan() {
+  if(DEBUG) Serial.println("start wifi scan");
+  // async, the results are collected in handleWifiScan so a page render never waits on the radio
+  if(WiFi.scanNetworks(true) >= WIFI_SCAN_RUNNING){
+    scan_running = true;
+  }
+  last_scan_start = millis();
+}
+
+// scans only while somebody looks at the list, at most every MIN_SCAN_INTERVAL_MS and never during a firmware upload
+void requestWifiScan() {
+  if(scan_running || Update.isRunning()) return;
+  if(millis() - last_scan_start < MIN_SCAN_INTERVAL_MS) return;
+  startWifiScan();
+}
+
+void handleWifiScan() {
+  if(!scan_running) return;
+
+  int8_t found = WiFi.scanComplete();
+  if(found == WIFI_SCAN_RUNNING) return;
+  scan_running = false;
+  if(found < 0) return; // failed, keep the previous results until the next scan
+
+  // insertion sort by signal strength, duplicate ssids (multiple access points) keep the strongest entry
+  num_scan_results = 0;
+  for (int i = 0; i < found; i++){
+    const char* ssid = WiFi.SSID(i);
+    int8_t rssi = (int8_t)WiFi.RSSI(i);
+    if(ssid == nullptr || ssid[0] == '\0' || strlen(ssid) > 32) continue; // hidden network
+
+    int pos = -1;
+    for (int j = 0; j < num_scan_results; j++){
+      if(strcmp(scan_results[j].ssid, ssid) == 0){
+        pos = j;
+        break;
+      }
+    }
+    if(pos >= 0){
+      if(scan_results[pos].rssi >= rssi) continue;
+    }else if(num_scan_results < MAX_SCAN_RESULTS){
+      pos = num_scan_results++;
+    }else if(scan_results[MAX_SCAN_RESULTS - 1].rssi < rssi){
+      pos = MAX_SCAN_RESULTS - 1;
+    }else{
+      continue;
+    }
+
+    while(pos > 0 && scan_results[pos - 1].rssi < rssi){
+      scan_results[pos] = scan_results[pos - 1];
+      pos--;
+    }
+    strcpy(scan_results[pos].ssid, ssid);
+    scan_results[pos].rssi = rssi;
+    scan_results[pos].isProtected = WiFi.encryptionType(i) != ENC_TYPE_NONE;
+  }
+  WiFi.scanDelete();
+
+  if(DEBUG) Serial.println("wifi scan found " + String(num_scan_results) + " networks");
+}
+
+void appendHtmlEscaped(String& out, const char* str) {
+  for (; *str; str++){
+    switch(*str){
+      case '&': out += "&amp;"; break;
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      case '"': out += "&quot;"; break;
+      default: out += *str;
+    }
+  }
+}
+
+void appendJsonEscaped(String& out, const char* str) {
+  for (; *str; str++){
+    if(*str == '"' || *str == '\\'){
+      out += '\\';
+      out += *str;
+    }else if((uint8_t)*str < 0x20){
+      char esc[7];
+      snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)*str);
+      out += esc;
+    }else{
+      out += *str;
+    }
+  }
+}
+
 #pragma endregion
 
 #pragma region ntp polling
@@ -689,7 +1223,7 @@ void startNtpPoll() {
   ntp_service = NTPClass();
   poll_successfull = false;
   rtc.adjust(1, 0, 0, 2010, 1,1);
-  poll_starttime = time(nullptr);
+  poll_start_us = rtc.getMonotonicMicros();
   WiFi.mode(WIFI_STA);
   // ... (rest of function is the same, WiFi.begin(...) etc.)
 }
@@ -707,7 +1241,7 @@ void cancelNtpPoll() {
 
 void saveDataEEPROM()
 {
-  if(DEBUG) Serial.println(current_settings.getPrintableString());
+  if(DEBUG) PrintSettings();
   EEPROM.put(ADDRESS_SETTINGS, current_settings);
 
   EEPROM.commit();
@@ -716,13 +1250,50 @@ void saveDataEEPROM()
 void readDataEEPROM()
 {
   EEPROM.get(ADDRESS_SETTINGS, current_settings);
-  if(DEBUG) Serial.println(current_settings.getPrintableString());
+  current_settings.sanitize();
+  if(DEBUG) PrintSettings();
 }
 
 void resetData()
 {
-  current_settings = DEFAULT_SETTINGS;
+  setCurrentSettings(DEFAULT_SETTINGS);
   saveDataEEPROM();
 }
 
-#pragma endregion
\ No newline at end of file
+// i2c_request_provision copies current_settings in the interrupt, it must never see half of an assignment
+void setCurrentSettings(const settings& s)
+{
+  noInterrupts();
+  current_settings = s;
+  interrupts();
+}
+
+// builds the new settings from the committed payload and only replaces current_settings if all of them are valid
+void commitProvisioning()
+{
+  provision_payload payload;
+  noInterrupts();
+  payload = provision_committed;
+  uint8_t transfer = provision_committed_transfer;
+  interrupts();
+
+  settings new_settings = current_settings;
+  payloadToSettings(payload, new_settings);
+  bool valid = validateSettings(new_settings, NUM_TIMEZONES) == settings_ok;
+
+  noInterrupts();
+  if(valid){
+    current_settings = new_settings;
+  }
+  // a transfer started since the commit has its own feedback, the result of this one must not be reported for it
+  if(transfer == provision_transfer){
+    provision_feedback = valid ? success : fail;
+  }
+  interrupts();
+
+  if(valid){
+    saveDataEEPROM();
+  }
+  if(DEBUG) Serial.println(valid ? "provisioning commit: ok" : "provisioning commit: failed");
+}
+
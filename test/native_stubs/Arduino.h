@@ -0,0 +1,42 @@
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+// Just enough of the Arduino API to build the libraries for the host (env:native)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef uint8_t byte;
+
+template<class T, class L> auto min(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+template<class T, class L> auto max(const T& a, const L& b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+
+class Print {
+public:
+    size_t print(const char* str) { return fputs(str, stdout) < 0 ? 0 : strlen(str); }
+    size_t println(const char* str) { return print(str) + print("\r\n"); }
+};
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// the Time library counts seconds with millis()
+inline uint32_t millis() { return (uint32_t)(clock() * 1000ULL / CLOCKS_PER_SEC); }
+
+// flash strings are plain strings on the host
+#define PROGMEM
+#define PGM_P const char*
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(const void* const*)(addr))
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#endif
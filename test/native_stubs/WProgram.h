@@ -0,0 +1,7 @@
+#ifndef WPROGRAM_STUB_H
+#define WPROGRAM_STUB_H
+
+// the Time and Timezone libraries include this instead of Arduino.h when ARDUINO is not defined
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef HARDWARE_SYNC_STUB_H
+#define HARDWARE_SYNC_STUB_H
+
+#include <stdint.h>
+
+// no interrupts on the host
+inline uint32_t save_and_disable_interrupts() { return 0; }
+inline void restore_interrupts(uint32_t status) { (void)status; }
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HARDWARE_TIMER_STUB_H
+#define HARDWARE_TIMER_STUB_H
+
+#include <stdint.h>
+#include <chrono>
+
+// the RP2040 timer counts microseconds since boot, the steady clock of the host stands in for it
+inline uint64_t time_us_64() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
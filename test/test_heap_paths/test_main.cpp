@@ -0,0 +1,166 @@
+#include <unity.h>
+#include <HeapProbe.h>
+#include <PicoEspTime.h>
+#include <Settings.h>
+#include <I2cProtocol.h>
+
+/*!
+    The i2c handlers and the idle loop must not touch the heap. The handlers themselves need the
+    hardware libraries, this runs the library code they call on the host with every allocation counted.
+    Not covered: the Wire calls themselves and the Wire.end()/begin() cycle of distributeTime(),
+    those only run on the device, see the pico_heapprobe environment.
+*/
+
+PicoEspTime rtc;
+
+TimeChangeRule CEST = {"CEST", Last, Sun, Mar, 2, 120};
+TimeChangeRule CET = {"CET ", Last, Sun, Oct, 3, 60};
+Timezone CE(CEST, CET);
+
+settings current_settings("Werk 2", "geheim123", true, false, 0, 0);
+
+// builds a command the way the master controller sends it, returns the length with the checksum
+template <class T> uint8_t command(byte (&buffer)[MAX_COMMAND_LENGTH + 1], const T& data) {
+    memcpy(buffer, &data, sizeof(data));
+    uint8_t checksum = 0;
+    for(size_t i = 0; i < sizeof(data); i++) checksum += buffer[i];
+    buffer[sizeof(data)] = checksum;
+    return sizeof(data) + 1;
+}
+
+void setUp() {
+    rtc.adjust(1, 0, 0, 2010, 1, 1);
+    rtc.read();
+    HeapProbe::reset();
+}
+
+void tearDown() {}
+
+void test_probe_counts_allocations() {
+    HeapProbe::reset();
+    {
+        HeapProbeScope probe(HEAP_PATH_PORTAL);
+        void* p = malloc(64);
+        free(p);
+        char* q = new char[16];
+        delete[] q;
+    }
+    HeapPathStats portal = HeapProbe::get(HEAP_PATH_PORTAL);
+    HeapPathStats i2c = HeapProbe::get(HEAP_PATH_I2C);
+
+    TEST_ASSERT_EQUAL_UINT32(2, portal.allocations);
+    TEST_ASSERT_GREATER_THAN(0, portal.highWater);
+    TEST_ASSERT_EQUAL_UINT32(0, i2c.allocations);
+}
+
+void test_scope_restores_previous_path() {
+    HeapProbe::reset();
+    {
+        HeapProbeScope outer(HEAP_PATH_NTP);
+        {
+            HeapProbeScope inner(HEAP_PATH_I2C); // an interrupt in the middle of the ntp path
+        }
+        free(malloc(8));
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, HeapProbe::get(HEAP_PATH_NTP).allocations);
+    TEST_ASSERT_EQUAL_UINT32(0, HeapProbe::get(HEAP_PATH_I2C).allocations);
+}
+
+// i2c_receive decodes and copies every command, i2c_request answers with the time or a provisioning chunk
+void test_i2c_path_does_not_allocate() {
+    byte buffer[MAX_COMMAND_LENGTH + 1];
+    uint8_t lengths[7];
+    byte commands[7][MAX_COMMAND_LENGTH + 1];
+    lengths[0] = command(commands[0], cmd_enable_ap_data{enable_ap, true});
+    lengths[1] = command(commands[1], cmd_poll_ntp_data{poll_ntp, 60, 3600});
+    lengths[2] = command(commands[2], (uint8_t)reset_data);
+    lengths[3] = command(commands[3], cmd_provision_chunk_data{provision_chunk, 0, {1, 2, 3}});
+    lengths[4] = command(commands[4], (uint8_t)provision_commit);
+    lengths[5] = command(commands[5], cmd_provision_read_data{provision_read, 1});
+    lengths[6] = command(commands[6], cmd_set_distribution_data{set_distribution, 1, 2, {10, 11}});
+
+    cmd_provision_chunk_data chunk;
+    cmd_set_distribution_data distribution;
+    byte provision_buffer[PROVISION_NUM_CHUNKS * PROVISION_CHUNK_LENGTH] = {};
+    volatile uint32_t sink = 0;
+
+    HeapProbe::reset();
+    {
+        HeapProbeScope probe(HEAP_PATH_I2C);
+        for (int i = 0; i < 1000; i++){
+            // i2c_receive
+            for (int c = 0; c < 7; c++){
+                memcpy(buffer, commands[c], lengths[c]);
+                uint8_t cmd_id = decodeCommand(buffer, lengths[c]);
+                TEST_ASSERT_EQUAL_UINT8(c, cmd_id);
+                if(cmd_id == provision_chunk){
+                    memcpy(&chunk, buffer, sizeof(chunk));
+                    memcpy(&provision_buffer[chunk.seq * PROVISION_CHUNK_LENGTH], chunk.data, PROVISION_CHUNK_LENGTH);
+                } else if(cmd_id == set_distribution){
+                    memcpy(&distribution, buffer, sizeof(distribution));
+                }
+            }
+
+            // i2c_request, time reply
+            byte reply[REPLY_LENGTH];
+            getTimeReply(reply, 1, current_settings, CE, rtc.getEpoch() + i);
+            sink += reply[REPLY_LENGTH - 1];
+
+            // i2c_request_provision
+            byte provisionReply[PROVISION_REPLY_LENGTH] = {};
+            provision_payload payload;
+            settingsToPayload(current_settings, payload);
+            memset(payload.pass, 0, sizeof(payload.pass));
+            uint8_t seq = i % PROVISION_NUM_CHUNKS;
+            size_t offset = seq * PROVISION_CHUNK_LENGTH;
+            memcpy(&provisionReply[2], (byte*)&payload + offset, min((size_t)PROVISION_CHUNK_LENGTH, sizeof(payload) - offset));
+            provisionReply[PROVISION_REPLY_LENGTH - 1] = getChecksum(provisionReply);
+            sink += provisionReply[PROVISION_REPLY_LENGTH - 1];
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, HeapProbe::get(HEAP_PATH_I2C).allocations, "i2c path allocated");
+}
+
+// loop() while idle: second edge check and frame of the time distribution, provisioning commit, calendar fields and formatting
+void test_idle_path_does_not_allocate() {
+    char buffer[64];
+    struct tm t;
+    volatile int64_t sink = 0;
+    provision_payload committed;
+    settingsToPayload(current_settings, committed);
+
+    HeapProbe::reset();
+    {
+        HeapProbeScope probe(HEAP_PATH_IDLE);
+        for (int i = 0; i < 1000; i++){
+            sink += rtc.getEpoch();
+
+            // distributeTime without the bus
+            byte reply[REPLY_LENGTH];
+            getTimeReply(reply, 1, current_settings, CE, rtc.getEpoch() + i);
+            byte frame[TIME_FRAME_LENGTH];
+            frame[0] = 0x54;
+            memcpy(&frame[1], reply, REPLY_LENGTH);
+            sink += frame[TIME_FRAME_LENGTH - 1];
+
+            // commitProvisioning without the eeprom
+            settings new_settings = current_settings;
+            payloadToSettings(committed, new_settings);
+            sink += validateSettings(new_settings, 9);
+
+            rtc.read();
+            rtc.getTime(buffer, sizeof(buffer), "%A, %B %d %Y %H:%M:%S");
+            PicoEspTime::breakTime(1262307600 + i * 86400LL, t);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, HeapProbe::get(HEAP_PATH_IDLE).allocations, "idle path allocated");
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_probe_counts_allocations);
+    RUN_TEST(test_scope_restores_previous_path);
+    RUN_TEST(test_i2c_path_does_not_allocate);
+    RUN_TEST(test_idle_path_does_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,111 @@
+#include <unity.h>
+#include <Settings.h>
+#include <I2cProtocol.h>
+
+/*!
+    The wire format the master controller depends on: command validation, the time reply and the provisioning payload.
+*/
+
+TimeChangeRule CEST = {"CEST", Last, Sun, Mar, 2, 120};
+TimeChangeRule CET = {"CET ", Last, Sun, Oct, 3, 60};
+Timezone CE(CEST, CET);
+
+const int64_t JAN_15_2030_1230_UTC = 1894710600; // winter, CET is UTC+1
+
+static uint8_t withChecksum(byte (&buffer)[MAX_COMMAND_LENGTH + 1], uint8_t dataLength) {
+    uint8_t checksum = 0;
+    for(int i = 0; i < dataLength; i++) checksum += buffer[i];
+    buffer[dataLength] = checksum;
+    return dataLength + 1;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_decode_command() {
+    byte buffer[MAX_COMMAND_LENGTH + 1] = {enable_ap, 1};
+    TEST_ASSERT_EQUAL_UINT8(enable_ap, decodeCommand(buffer, withChecksum(buffer, 2)));
+
+    buffer[2]++; // wrong checksum
+    TEST_ASSERT_EQUAL_UINT8(cmd_invalid, decodeCommand(buffer, 3));
+
+    // a valid checksum does not help a command of the wrong length
+    TEST_ASSERT_EQUAL_UINT8(cmd_invalid, decodeCommand(buffer, withChecksum(buffer, 3)));
+    buffer[0] = reset_data;
+    TEST_ASSERT_EQUAL_UINT8(cmd_invalid, decodeCommand(buffer, withChecksum(buffer, 2)));
+    TEST_ASSERT_EQUAL_UINT8(reset_data, decodeCommand(buffer, withChecksum(buffer, 1)));
+
+    buffer[0] = provision_chunk;
+    TEST_ASSERT_EQUAL_UINT8(provision_chunk, decodeCommand(buffer, withChecksum(buffer, sizeof(cmd_provision_chunk_data))));
+    buffer[0] = set_distribution;
+    TEST_ASSERT_EQUAL_UINT8(set_distribution, decodeCommand(buffer, withChecksum(buffer, sizeof(cmd_set_distribution_data))));
+
+    buffer[0] = 7; // unknown command
+    TEST_ASSERT_EQUAL_UINT8(cmd_invalid, decodeCommand(buffer, withChecksum(buffer, 1)));
+    TEST_ASSERT_EQUAL_UINT8(cmd_invalid, decodeCommand(buffer, 1));
+}
+
+void test_time_reply() {
+    byte reply[REPLY_LENGTH];
+    settings s("", "", false, false, 0, 0);
+
+    getTimeReply(reply, 3, s, CE, JAN_15_2030_1230_UTC);
+    TEST_ASSERT_EQUAL_UINT8(3, reply[0]);
+    TEST_ASSERT_EQUAL_UINT8(13, reply[1]);
+    TEST_ASSERT_EQUAL_UINT8(30, reply[2]);
+    TEST_ASSERT_EQUAL_UINT8(0, reply[3]);
+    TEST_ASSERT_EQUAL_UINT8((uint8_t)(3 + 13 + 30), reply[4]);
+
+    // a fixed offset ignores the time zone
+    s.useGmtOffset = true;
+    s.gmtOffset = -5;
+    getTimeReply(reply, 1, s, CE, JAN_15_2030_1230_UTC + 59);
+    TEST_ASSERT_EQUAL_UINT8(7, reply[1]);
+    TEST_ASSERT_EQUAL_UINT8(30, reply[2]);
+    TEST_ASSERT_EQUAL_UINT8(59, reply[3]);
+}
+
+void test_payload_round_trip() {
+    settings s("Werk 2", "geheim123", true, true, -3, 4);
+    provision_payload payload;
+    settingsToPayload(s, payload);
+    TEST_ASSERT_TRUE(PROVISION_NUM_CHUNKS * PROVISION_CHUNK_LENGTH >= sizeof(payload));
+
+    settings back("", "", false, false, 0, 0);
+    payloadToSettings(payload, back);
+    TEST_ASSERT_EQUAL_STRING("Werk 2", back.getSSID());
+    TEST_ASSERT_EQUAL_STRING("geheim123", back.getPass());
+    TEST_ASSERT_TRUE(back.isProtected);
+    TEST_ASSERT_TRUE(back.useGmtOffset);
+    TEST_ASSERT_EQUAL(-3, back.gmtOffset);
+    TEST_ASSERT_EQUAL(4, back.timezoneIdx);
+
+    // an overlong length stays overlong so the validation rejects it, the strings stay terminated
+    payload.ssidLength = 200;
+    payloadToSettings(payload, back);
+    TEST_ASSERT_EQUAL(33, back.ssidLength);
+    TEST_ASSERT_EQUAL('\0', back.ssid[32]);
+    TEST_ASSERT_EQUAL_UINT8(settings_too_long, validateSettings(back, 9));
+}
+
+void test_distribution_addresses() {
+    TEST_ASSERT_TRUE(isValidDistributionAddress(0x08, 40));
+    TEST_ASSERT_TRUE(isValidDistributionAddress(41, 40));
+    TEST_ASSERT_TRUE(isValidDistributionAddress(0x77, 40));
+    TEST_ASSERT_FALSE(isValidDistributionAddress(40, 40));
+    for (int address = 0x00; address <= 0x07; address++){
+        TEST_ASSERT_FALSE(isValidDistributionAddress(address, 40));
+    }
+    for (int address = 0x78; address <= 0xFF; address++){
+        TEST_ASSERT_FALSE(isValidDistributionAddress(address, 40));
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_decode_command);
+    RUN_TEST(test_time_reply);
+    RUN_TEST(test_payload_round_trip);
+    RUN_TEST(test_distribution_addresses);
+    return UNITY_END();
+}
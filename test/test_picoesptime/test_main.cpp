@@ -0,0 +1,143 @@
+#include <unity.h>
+#include <PicoEspTime.h>
+#include <chrono>
+#include <sys/time.h>
+
+PicoEspTime rtc;
+
+void setUp() {}
+void tearDown() {}
+
+static bool sameTm(const struct tm& a, const struct tm& b) {
+    return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday &&
+           a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec &&
+           a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday;
+}
+
+// 1811 to 2223, in steps that hit every time of day and day of the week
+void test_break_time_matches_gmtime() {
+    for (int64_t epoch = -5000000000LL; epoch < 8000000000LL; epoch += 86400 * 3 + 3607){
+        struct tm expected;
+        struct tm actual;
+        time_t t = epoch;
+        gmtime_r(&t, &expected);
+        PicoEspTime::breakTime(epoch, actual);
+        TEST_ASSERT_TRUE_MESSAGE(sameTm(expected, actual), "breakTime differs from gmtime_r");
+    }
+}
+
+void test_break_time_edges() {
+    const int64_t edges[] = {0, -1, 86399, 86400, 951782400 /* 2000-02-29 */, 4107542399LL /* 2100-02-28 23:59:59 */,
+                             2147483647LL, 2147483648LL /* past 2038 */, 253402300799LL /* 9999-12-31 23:59:59 */};
+    for (int64_t epoch : edges){
+        struct tm expected;
+        struct tm actual;
+        time_t t = epoch;
+        gmtime_r(&t, &expected);
+        PicoEspTime::breakTime(epoch, actual);
+        TEST_ASSERT_TRUE_MESSAGE(sameTm(expected, actual), "breakTime differs from gmtime_r");
+    }
+}
+
+void test_make_time_round_trip() {
+    for (int64_t epoch = 0; epoch < 8000000000LL; epoch += 86400 * 5 + 7211){
+        struct tm t;
+        PicoEspTime::breakTime(epoch, t);
+        TEST_ASSERT_EQUAL_INT64(epoch, PicoEspTime::makeTime(t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec));
+    }
+}
+
+void test_adjust_and_read() {
+    rtc.adjust(13, 37, 42, 2040, 2, 29); // after the 32 bit rollover
+    rtc.read();
+    TEST_ASSERT_EQUAL(2040, rtc.year);
+    TEST_ASSERT_EQUAL(1, rtc.month); // 0 based like tm_mon
+    TEST_ASSERT_EQUAL(29, rtc.dayOfMonth);
+    TEST_ASSERT_EQUAL(13, rtc.hour);
+    TEST_ASSERT_EQUAL(37, rtc.minute);
+    TEST_ASSERT_GREATER_OR_EQUAL(42, rtc.second);
+    TEST_ASSERT_EQUAL(3, rtc.dayOfWeek); // wednesday
+
+    char buffer[32];
+    TEST_ASSERT_GREATER_THAN(0, rtc.getTime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M"));
+    TEST_ASSERT_EQUAL_STRING("2040-02-29 13:37", buffer);
+    TEST_ASSERT_EQUAL(0, rtc.getTime(buffer, 4, "%Y-%m-%d")); // does not fit
+}
+
+void test_adjust_micros_keeps_sub_second() {
+    rtc.adjustMicros(1700000000LL * 1000000 + 250000);
+    int64_t us = rtc.getEpochMicros();
+    TEST_ASSERT_EQUAL_INT64(1700000000LL, rtc.getEpoch());
+    TEST_ASSERT_GREATER_OR_EQUAL(250000, us % 1000000);
+}
+
+/*!
+    benchmark against the previous implementation: read() called gettimeofday, time and localtime every time,
+    getTime() copied the format into 128 byte buffers and called localtime again
+*/
+
+static time_t legacy_now;
+static uint8_t legacy_fields[7];
+
+static void legacyRead() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    legacy_now = time(nullptr);
+    struct tm* p_tm = localtime(&legacy_now);
+    legacy_fields[0] = p_tm->tm_sec;
+    legacy_fields[1] = p_tm->tm_min;
+    legacy_fields[2] = p_tm->tm_hour;
+    legacy_fields[3] = p_tm->tm_wday;
+    legacy_fields[4] = p_tm->tm_mday;
+    legacy_fields[5] = p_tm->tm_mon;
+    legacy_fields[6] = p_tm->tm_year;
+}
+
+static void legacyGetTime(const char* format, char* out) {
+    char s[128];
+    char c[128];
+    strncpy(c, format, 127);
+    c[127] = '\0';
+    struct tm* timeinfo = localtime(&legacy_now);
+    strftime(s, 127, c, timeinfo);
+    strcpy(out, s);
+}
+
+template <class F> static double nanosPerCall(F f, int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+void test_benchmark_read_and_get_time() {
+    const int iterations = 200000;
+    const char* format = "%A, %B %d %Y %H:%M:%S";
+    char out[128];
+    rtc.adjust(1, 0, 0, 2010, 1, 1);
+
+    double legacy_read = nanosPerCall([]() { legacyRead(); }, iterations);
+    double new_read = nanosPerCall([]() { rtc.read(); }, iterations);
+    double legacy_format = nanosPerCall([&]() { legacyGetTime(format, out); }, iterations);
+    double new_format = nanosPerCall([&]() { rtc.getTime(out, sizeof(out), format); }, iterations);
+
+    char line[128];
+    snprintf(line, sizeof(line), "read():    legacy %.1f ns, new %.1f ns", legacy_read, new_read);
+    TEST_MESSAGE(line);
+    snprintf(line, sizeof(line), "getTime(): legacy %.1f ns, new %.1f ns", legacy_format, new_format);
+    TEST_MESSAGE(line);
+
+    // within a second read() is a single compare, it has to beat a localtime() call
+    TEST_ASSERT_TRUE(new_read < legacy_read);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_break_time_matches_gmtime);
+    RUN_TEST(test_break_time_edges);
+    RUN_TEST(test_make_time_round_trip);
+    RUN_TEST(test_adjust_and_read);
+    RUN_TEST(test_adjust_micros_keeps_sub_second);
+    RUN_TEST(test_benchmark_read_and_get_time);
+    return UNITY_END();
+}
@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <FlatJson.h>
+#include <Settings.h>
+#include <hardware/timer.h>
+
+/*!
+    The json api parser and the settings validation run on the host, the web server around them does not.
+    The provisioning rate covers the device side of one POST /api/settings, the network round trip is not included.
+*/
+
+#define NUM_TIMEZONES 10
+
+struct collected_fields {
+    char keys[8][FLATJSON_MAX_KEY_LENGTH + 1];
+    char values[8][FLATJSON_MAX_VALUE_LENGTH + 1];
+    bool quoted[8];
+    uint8_t count;
+};
+
+collected_fields fields;
+
+static void collectField(const char* key, const char* value, bool quoted, void* context) {
+    collected_fields& f = *(collected_fields*)context;
+    if(f.count >= 8) return;
+    strcpy(f.keys[f.count], key);
+    strcpy(f.values[f.count], value);
+    f.quoted[f.count] = quoted;
+    f.count++;
+}
+
+static uint8_t parse(const char* body) {
+    memset(&fields, 0, sizeof(fields));
+    FlatJsonParser parser(collectField, &fields);
+    parser.feed(body, strlen(body));
+    parser.finish();
+    return parser.error();
+}
+
+static settings defaults() {
+    return settings("", "", false, false, 0, 0);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_flat_object() {
+    TEST_ASSERT_EQUAL(flatjson_ok, parse("{}"));
+    TEST_ASSERT_EQUAL(0, fields.count);
+
+    TEST_ASSERT_EQUAL(flatjson_ok, parse(" { \"ssid\" : \"Werk 2\", \"protected\":true,\"timezone\": -3 ,\"x\":null } "));
+    TEST_ASSERT_EQUAL(4, fields.count);
+    TEST_ASSERT_EQUAL_STRING("ssid", fields.keys[0]);
+    TEST_ASSERT_EQUAL_STRING("Werk 2", fields.values[0]);
+    TEST_ASSERT_TRUE(fields.quoted[0]);
+    TEST_ASSERT_EQUAL_STRING("true", fields.values[1]);
+    TEST_ASSERT_FALSE(fields.quoted[1]);
+    TEST_ASSERT_EQUAL_STRING("-3", fields.values[2]);
+    TEST_ASSERT_EQUAL_STRING("null", fields.values[3]);
+}
+
+void test_escapes() {
+    TEST_ASSERT_EQUAL(flatjson_ok, parse("{\"ssid\":\"a\\\"b\\\\c\\/d\\n\"}"));
+    TEST_ASSERT_EQUAL_STRING("a\"b\\c/d\n", fields.values[0]);
+
+    // \u escapes end up as utf-8
+    TEST_ASSERT_EQUAL(flatjson_ok, parse("{\"ssid\":\"B\\u00e4ckerei \\u20AC\"}"));
+    TEST_ASSERT_EQUAL_STRING("B\xC3\xA4" "ckerei \xE2\x82\xAC", fields.values[0]);
+
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"ssid\":\"\\ud83d\\ude00\"}")); // surrogates are not supported
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"ssid\":\"\\u00g0\"}"));
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"ssid\":\"\\x\"}"));
+}
+
+void test_syntax_errors() {
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"ssid\":\"a\",}")); // trailing comma
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{,}"));
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"a\":{\"b\":1}}")); // nesting
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"a\":[1,2]}"));
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("[]"));
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"a\":1} x")); // trailing garbage
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"a\" 1}"));
+    TEST_ASSERT_EQUAL(flatjson_syntax, parse("{\"a\":\"line\nbreak\"}"));
+}
+
+void test_truncated_input() {
+    const char* body = "{\"ssid\":\"Werk 2\",\"protected\":true}";
+    for(size_t length = 0; length < strlen(body); length++){
+        memset(&fields, 0, sizeof(fields));
+        FlatJsonParser parser(collectField, &fields);
+        parser.feed(body, length);
+        TEST_ASSERT_FALSE(parser.finish());
+        TEST_ASSERT_EQUAL(flatjson_incomplete, parser.error());
+    }
+}
+
+void test_length_limits() {
+    // the value buffer holds 33 bytes, one more than the longest ssid or password
+    char body[128];
+    snprintf(body, sizeof(body), "{\"ssid\":\"%s\"}", "123456789012345678901234567890123");
+    TEST_ASSERT_EQUAL(flatjson_ok, parse(body));
+    snprintf(body, sizeof(body), "{\"ssid\":\"%s\"}", "1234567890123456789012345678901234");
+    TEST_ASSERT_EQUAL(flatjson_too_long, parse(body));
+    snprintf(body, sizeof(body), "{\"%s\":1}", "123456789012345678901234");
+    TEST_ASSERT_EQUAL(flatjson_ok, parse(body));
+    snprintf(body, sizeof(body), "{\"%s\":1}", "1234567890123456789012345");
+    TEST_ASSERT_EQUAL(flatjson_key_too_long, parse(body));
+}
+
+void test_settings_errors() {
+    settings s = defaults();
+    const char* full = "{\"ssid\":\"Werk 2\",\"pass\":\"geheim123\",\"protected\":true,\"timezone\":42,\"use_gmt_offset\":true,\"gmt_offset\":-20}";
+    TEST_ASSERT_EQUAL(settings_ok, parseSettingsJson(full, strlen(full), s, NUM_TIMEZONES));
+    TEST_ASSERT_EQUAL_STRING("Werk 2", s.getSSID());
+    TEST_ASSERT_EQUAL_STRING("geheim123", s.getPass());
+    TEST_ASSERT_TRUE(s.isProtected);
+    TEST_ASSERT_EQUAL(NUM_TIMEZONES - 1, s.timezoneIdx);
+    TEST_ASSERT_EQUAL(-12, s.gmtOffset);
+
+    const char* cases[][2] = {
+        {"{\"ssid\":\"123456789012345678901234567890123\"}", "too long ssid"},
+        {"{\"pass\":\"1234567890123456789012345678901234\"}", "value longer than the parser buffer"},
+    };
+    for(auto& c : cases){
+        s = defaults();
+        TEST_ASSERT_EQUAL_MESSAGE(settings_too_long, parseSettingsJson(c[0], strlen(c[0]), s, NUM_TIMEZONES), c[1]);
+    }
+
+    const char* malformed[] = {
+        "{\"an_unknown_key_that_is_too_long\":1}",
+        "{\"unknown\":1}",
+        "{\"timezone\":\"3\"}",
+        "{\"timezone\":3x}",
+        "{\"protected\":1}",
+        "{\"ssid\":\"a\",}",
+        "{\"ssid\":\"a\"",
+    };
+    for(const char* body : malformed){
+        s = defaults();
+        TEST_ASSERT_EQUAL_MESSAGE(settings_malformed, parseSettingsJson(body, strlen(body), s, NUM_TIMEZONES), body);
+    }
+
+    s = defaults();
+    const char* shortPass = "{\"pass\":\"kurz\",\"protected\":true}";
+    TEST_ASSERT_EQUAL(settings_pass_too_short, parseSettingsJson(shortPass, strlen(shortPass), s, NUM_TIMEZONES));
+}
+
+void test_provisioning_rate() {
+    // every unit gets its own body, as the provisioning script sends them
+    const int units = 20000;
+    char body[160];
+    uint32_t accepted = 0;
+    uint64_t start = time_us_64();
+    for(int i = 0; i < units; i++){
+        int length = snprintf(body, sizeof(body),
+            "{\"ssid\":\"Werk %d\",\"pass\":\"schluessel-%05d\",\"protected\":true,\"timezone\":%d,\"use_gmt_offset\":false,\"gmt_offset\":0}",
+            i % 4, i, i % NUM_TIMEZONES);
+        settings s = defaults();
+        if(parseSettingsJson(body, length, s, NUM_TIMEZONES) == settings_ok) accepted++;
+    }
+    uint64_t elapsed = time_us_64() - start;
+    TEST_ASSERT_EQUAL(units, accepted);
+
+    double perUnitMicros = (double)elapsed / units;
+    double unitsPerMinute = 60e6 / perUnitMicros;
+    char message[120];
+    snprintf(message, sizeof(message), "host, parse and validate: %.2f us per unit, %.0f units per minute", perUnitMicros, unitsPerMinute);
+    TEST_MESSAGE(message);
+    // the form needs a person per unit, the api must not be what limits a script
+    TEST_ASSERT_TRUE(unitsPerMinute > 6000);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_flat_object);
+    RUN_TEST(test_escapes);
+    RUN_TEST(test_syntax_errors);
+    RUN_TEST(test_truncated_input);
+    RUN_TEST(test_length_limits);
+    RUN_TEST(test_settings_errors);
+    RUN_TEST(test_provisioning_rate);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+/*!
+    Bus simulation of the time distribution against every controller polling on its own.
+    One minute of a shared 25kHz bus, transfers that find the bus busy wait for it to become free.
+    The frame sizes are the ones of the firmware: a poll reads REPLY_LENGTH (5) bytes,
+    a pushed frame is TIME_FRAME_LENGTH (6) bytes, the push waits BUS_IDLE_CHECK_US (120us) first.
+    A broadcast is a hardware general call, the address of this module goes before the frame.
+    A controller that is powered off only nacks its address, the push checks the bus again and goes on with the next one.
+*/
+
+const uint32_t BUS_CLOCK_HZ = 25000;
+const uint32_t POLL_REPLY_BYTES = 5;
+const uint32_t TIME_FRAME_BYTES = 6;
+const uint32_t HARDWARE_GENERAL_CALL_BYTES = 1;
+const uint32_t BUS_IDLE_CHECK_US = 120;
+const uint32_t POLL_HZ = 1;
+const uint32_t SIM_SECONDS = 60;
+
+enum mode {mode_polling, mode_list, mode_broadcast};
+
+struct sim_result {
+    double utilization; // share of the time the bus is busy
+    double meanDelayMs; // from the second edge until a controller has the new time
+    uint32_t delivered; // frames or replies that reached a controller
+};
+
+// start + address/ack + data bytes with ack + stop, in microseconds
+static uint32_t transferMicros(uint32_t dataBytes) {
+    uint32_t bits = 1 + 9 + 9 * dataBytes + 1;
+    return bits * 1000000 / BUS_CLOCK_HZ;
+}
+
+// start + address with nack + stop
+static uint32_t nackMicros() {
+    return (1 + 9 + 1) * 1000000 / BUS_CLOCK_HZ;
+}
+
+static uint32_t lcg(uint32_t& state) {
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+static sim_result simulate(mode m, uint32_t receivers, int32_t deadReceiver = -1) {
+    struct request { uint64_t at; uint32_t duration; uint64_t edge; bool delivered; };
+    std::vector<request> requests;
+    uint32_t seed = 12345;
+
+    // the controllers poll at a fixed phase each, pushes start at the second edge
+    std::vector<uint64_t> phase(receivers);
+    for (uint32_t r = 0; r < receivers; r++) phase[r] = lcg(seed) % (1000000 / POLL_HZ);
+
+    for (uint64_t second = 0; second < SIM_SECONDS; second++){
+        uint64_t edge = second * 1000000;
+        if(m == mode_polling){
+            for (uint32_t r = 0; r < receivers; r++){
+                for (uint32_t p = 0; p < POLL_HZ; p++){
+                    uint64_t at = edge + phase[r] + p * (1000000 / POLL_HZ);
+                    requests.push_back({at, transferMicros(POLL_REPLY_BYTES), edge, true});
+                }
+            }
+        } else if(m == mode_list){
+            for (uint32_t r = 0; r < receivers; r++){
+                bool dead = (int32_t)r == deadReceiver;
+                uint32_t duration = (r == 0 ? BUS_IDLE_CHECK_US : 0) + (dead ? nackMicros() + BUS_IDLE_CHECK_US : transferMicros(TIME_FRAME_BYTES));
+                requests.push_back({edge, duration, edge, !dead});
+            }
+        } else {
+            requests.push_back({edge, BUS_IDLE_CHECK_US + transferMicros(HARDWARE_GENERAL_CALL_BYTES + TIME_FRAME_BYTES), edge, true});
+        }
+    }
+    std::stable_sort(requests.begin(), requests.end(), [](const request& a, const request& b) { return a.at < b.at; });
+
+    uint64_t busFree = 0;
+    uint64_t busy = 0;
+    double delaySum = 0;
+    uint32_t delivered = 0;
+    for (const request& req : requests){
+        uint64_t start = std::max(req.at, busFree);
+        busFree = start + req.duration;
+        busy += req.duration;
+        if(req.delivered){
+            delaySum += busFree - req.edge;
+            delivered++;
+        }
+    }
+
+    sim_result result;
+    result.utilization = (double)busy / (SIM_SECONDS * 1000000.0);
+    // a broadcast reaches every receiver with one frame
+    result.delivered = (m == mode_broadcast) ? delivered * receivers : delivered;
+    result.meanDelayMs = delaySum / (double)delivered / 1000.0;
+    return result;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_bus_utilization() {
+    const uint32_t counts[] = {1, 8, 32};
+    sim_result polling[3], list[3], broadcast[3];
+    char line[128];
+
+    TEST_MESSAGE("receivers | polling util / delay | list util / delay | broadcast util / delay");
+    for (int i = 0; i < 3; i++){
+        polling[i] = simulate(mode_polling, counts[i]);
+        list[i] = simulate(mode_list, counts[i]);
+        broadcast[i] = simulate(mode_broadcast, counts[i]);
+        snprintf(line, sizeof(line), "%9lu | %6.2f%% / %6.1fms | %6.2f%% / %6.1fms | %6.2f%% / %6.1fms",
+                 (unsigned long)counts[i], polling[i].utilization * 100, polling[i].meanDelayMs,
+                 list[i].utilization * 100, list[i].meanDelayMs, broadcast[i].utilization * 100, broadcast[i].meanDelayMs);
+        TEST_MESSAGE(line);
+    }
+
+    // polling and pushing to a list grow with every receiver, a broadcast does not
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 32.0, polling[2].utilization / polling[0].utilization);
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, (BUS_IDLE_CHECK_US + 32 * transferMicros(TIME_FRAME_BYTES)) / 1000000.0, list[2].utilization);
+    TEST_ASSERT_TRUE(broadcast[0].utilization == broadcast[2].utilization);
+    TEST_ASSERT_TRUE(broadcast[2].utilization * 20 < polling[2].utilization);
+
+    // pushed frames arrive right after the edge, a poll sees the new second only when its turn comes
+    TEST_ASSERT_TRUE(broadcast[2].meanDelayMs < 5);
+    TEST_ASSERT_TRUE(polling[2].meanDelayMs > 100);
+}
+
+// the first controller of the list is powered off, every other one still gets the frame each second
+void test_list_with_dead_receiver() {
+    sim_result healthy = simulate(mode_list, 8);
+    sim_result dead = simulate(mode_list, 8, 0);
+    char line[128];
+    snprintf(line, sizeof(line), "8 receivers, first one dead: %lu of %lu frames, %.2f%% util, %.1fms delay",
+             (unsigned long)dead.delivered, (unsigned long)healthy.delivered, dead.utilization * 100, dead.meanDelayMs);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL_UINT32(8 * SIM_SECONDS, healthy.delivered);
+    TEST_ASSERT_EQUAL_UINT32(7 * SIM_SECONDS, dead.delivered);
+    // the nack and the bus check afterwards take less time than a full frame
+    TEST_ASSERT_TRUE(dead.utilization < healthy.utilization);
+    TEST_ASSERT_TRUE(dead.meanDelayMs < 20);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_bus_utilization);
+    RUN_TEST(test_list_with_dead_receiver);
+    return UNITY_END();
+}